@@ -0,0 +1,46 @@
+#include "Bitmap.h"
+
+using namespace Clustering;
+
+namespace Clustering {
+
+    std::vector<std::uint64_t> &Bitmap::mutableWords()
+    {
+        if (__words.use_count() > 1)
+        {
+            __words = std::make_shared<std::vector<std::uint64_t> >(*__words);
+        }
+        return *__words;
+    }
+
+    void Bitmap::clear()
+    {
+        std::vector<std::uint64_t> &words = mutableWords();
+        for (unsigned int i = 0; i < words.size(); i++)
+        {
+            words[i] = 0;
+        }
+    }
+
+    unsigned int Bitmap::count() const
+    {
+        unsigned int total = 0;
+        for (unsigned int i = 0; i < __words->size(); i++)
+        {
+            total += __builtin_popcountll((*__words)[i]);
+        }
+        return total;
+    }
+
+    bool operator==(const Bitmap &lhs, const Bitmap &rhs)
+    {
+        return lhs.__capacity == rhs.__capacity &&
+               (lhs.__words == rhs.__words || *lhs.__words == *rhs.__words);
+    }
+
+    bool operator!=(const Bitmap &lhs, const Bitmap &rhs)
+    {
+        return !(lhs == rhs);
+    }
+
+}
@@ -0,0 +1,40 @@
+// Dense bitset over point indices of one dataset.
+// Membership tests are single word operations and whole sets compare
+// 64 points at a time. Copies share the words until one is modified.
+
+#ifndef CLUSTERING_BITMAP_H
+#define CLUSTERING_BITMAP_H
+
+#include <vector>
+#include <cstdint>
+#include <memory>
+
+namespace Clustering {
+
+    class Bitmap {
+        unsigned int __capacity;
+        std::shared_ptr<std::vector<std::uint64_t> > __words;
+
+        std::vector<std::uint64_t> &mutableWords();
+
+    public:
+        Bitmap() : __capacity(0), __words(std::make_shared<std::vector<std::uint64_t> >()) {};
+        Bitmap(unsigned int capacity) :
+                __capacity(capacity), __words(std::make_shared<std::vector<std::uint64_t> >((capacity + 63) / 64, 0)) {};
+
+        unsigned int capacity() const { return __capacity; }
+
+        void set(unsigned int index) { mutableWords()[index / 64] |= (std::uint64_t(1) << (index % 64)); }
+        void reset(unsigned int index) { mutableWords()[index / 64] &= ~(std::uint64_t(1) << (index % 64)); }
+        bool test(unsigned int index) const { return ((*__words)[index / 64] >> (index % 64)) & 1; }
+
+        void clear();
+        unsigned int count() const;
+
+        friend bool operator==(const Bitmap &, const Bitmap &);
+        friend bool operator!=(const Bitmap &, const Bitmap &);
+    };
+
+}
+
+#endif //CLUSTERING_BITMAP_H
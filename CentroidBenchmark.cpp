@@ -0,0 +1,115 @@
+// CentroidBenchmark.cpp
+// Times KMeans runs with the LLOYD and INDEXED assignment steps for growing
+// k on the same synthetic data and reports the k from which the index
+// stays ahead.
+//
+// usage: centroid_benchmark [points] [dims] [iterations]
+// Build with -DCMAKE_BUILD_TYPE=Release; unoptimized timings say little.
+// The first INDEXED iteration costs as much as a LLOYD one plus building
+// the index, so runs of only a few iterations mostly time that.
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdio>
+#include <random>
+#include <string>
+
+#include "KMeans.h"
+
+using std::cout;
+using std::endl;
+
+namespace {
+
+    // Gaussian blobs around random centres, one point per line
+    void writePoints(const std::string &file, unsigned int points, unsigned int dims)
+    {
+        std::mt19937 generator(2312);
+        std::uniform_real_distribution<double> centre(0, 1000);
+        std::normal_distribution<double> spread(0, 20);
+
+        std::vector<double> centres(256 * dims);
+        for (unsigned int i = 0; i < centres.size(); i++)
+            centres[i] = centre(generator);
+
+        std::ofstream csv(file);
+        csv << std::setprecision(10);
+        for (unsigned int p = 0; p < points; p++) {
+            const double *c = &centres[(p % 256) * dims];
+            for (unsigned int d = 0; d < dims; d++)
+                csv << (d > 0 ? "," : "") << c[d] + spread(generator);
+            csv << '\n';
+        }
+    }
+
+    // Seconds spent iterating; the final BetaCV score is quadratic in the
+    // points and the same for both algorithms, so it is left out
+    double time(unsigned int dims, int k, const std::string &file, KMeans::Algorithm algorithm,
+                unsigned int iterations, std::vector<int> &labels)
+    {
+        // The point reader echoes every line it parses
+        std::ostringstream echo;
+        std::streambuf *console = cout.rdbuf(echo.rdbuf());
+        KMeans kmeans(dims, k, file);
+        cout.rdbuf(console);
+
+        KMeans::Convergence convergence;
+        convergence.maxIterations = iterations;
+        convergence.maxShift = -1; // only a fixed point stops early
+        convergence.maxReassigned = 0;
+        kmeans.setConvergence(convergence);
+        kmeans.setAlgorithm(algorithm);
+
+        double seconds = 0;
+        kmeans.runAsync([&seconds](const KMeans::Progress &progress) {
+            seconds = progress.seconds;
+        }).wait();
+        labels = kmeans.getLabels();
+        return seconds;
+    }
+
+}
+
+int main(int argc, char *argv[]) {
+
+    unsigned int points = argc > 1 ? std::atoi(argv[1]) : 20000;
+    unsigned int dims = argc > 2 ? std::atoi(argv[2]) : 3;
+    unsigned int iterations = argc > 3 ? std::atoi(argv[3]) : 20;
+    const std::string file = "centroid_benchmark.csv";
+
+    writePoints(file, points, dims);
+
+    cout << points << " points, " << dims << " dimensions, " << iterations << " iterations" << endl;
+    cout << std::fixed << std::setprecision(4);
+    cout << std::setw(8) << "k" << std::setw(14) << "lloyd (s)" << std::setw(14) << "indexed (s)"
+         << std::setw(10) << "speedup" << std::setw(8) << "same" << endl;
+
+    int crossover = 0;
+    for (int k = 4; k <= 4096 && static_cast<unsigned int>(k) <= points; k *= 2) {
+        std::vector<int> lloydLabels, indexedLabels;
+        double lloyd = time(dims, k, file, KMeans::LLOYD, iterations, lloydLabels);
+        double indexed = time(dims, k, file, KMeans::INDEXED, iterations, indexedLabels);
+
+        // Smallest k beyond which INDEXED never loses again
+        double speedup = lloyd / indexed;
+        if (speedup <= 1)
+            crossover = 0;
+        else if (crossover == 0)
+            crossover = k;
+
+        cout << std::setw(8) << k << std::setw(14) << lloyd << std::setw(14) << indexed
+             << std::setw(10) << speedup
+             << std::setw(8) << (lloydLabels == indexedLabels ? "yes" : "NO") << endl;
+    }
+
+    if (crossover > 0)
+        cout << "INDEXED is faster for every k from " << crossover << " on" << endl;
+    else
+        cout << "INDEXED was not faster at the largest k" << endl;
+
+    std::remove(file.c_str());
+    return 0;
+}
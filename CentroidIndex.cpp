@@ -0,0 +1,225 @@
+#include "CentroidIndex.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace Clustering;
+
+namespace Clustering {
+
+    constexpr unsigned int CentroidIndex::MAX_NEIGHBOURS;
+
+    CentroidIndex::CentroidIndex(unsigned int dims) :
+            __dims(dims), __clusters(0), __width(0), __centroids(nullptr),
+            __distance(selectDistanceKernel<double>(dims))
+    {
+    }
+
+    void CentroidIndex::rebuild(const double *centroids, unsigned int k, ThreadPool &pool)
+    {
+        __centroids = centroids;
+        __clusters = k;
+        __width = (k > 0) ? std::min(k - 1, MAX_NEIGHBOURS) : 0;
+        __neighbours.resize(k * __width);
+        __separation.resize(k * __width);
+        __listed.resize(k);
+        __beyond.resize(k);
+
+        pool.parallelFor(0, k, 16, [this](unsigned int, unsigned int first, unsigned int last) {
+            for (unsigned int i = first; i < last; i++)
+            {
+                rebuildList(i);
+            }
+        });
+    }
+
+    void CentroidIndex::rebuildList(unsigned int i)
+    {
+        std::vector<std::pair<double, unsigned int> > others;
+        others.reserve(__clusters);
+        for (unsigned int j = 0; j < __clusters; j++)
+        {
+            if (j != i)
+            {
+                others.push_back(std::make_pair(
+                        __distance(__centroids + i * __dims, __centroids + j * __dims, __dims), j));
+            }
+        }
+
+        // The first centroid left out bounds all unlisted ones
+        unsigned int kept = std::min<unsigned int>(__width + 1, others.size());
+        std::partial_sort(others.begin(), others.begin() + kept, others.end());
+
+        for (unsigned int n = 0; n < __width; n++)
+        {
+            __separation[i * __width + n] = std::sqrt(others[n].first);
+            __neighbours[i * __width + n] = others[n].second;
+        }
+        __listed[i] = __width;
+        __beyond[i] = (others.size() > __width) ? std::sqrt(others[__width].first)
+                                                : std::numeric_limits<double>::infinity();
+    }
+
+    void CentroidIndex::updateList(unsigned int i, const std::vector<unsigned int> &moved,
+                                   const std::vector<bool> &isMoved)
+    {
+        // Listed centroids that stayed keep their distance; the moved ones
+        // are measured again and listed if they are now closer than every
+        // unlisted one. Centroids that stayed unlisted are still beyond.
+        std::vector<std::pair<double, unsigned int> > entries;
+        for (unsigned int n = 0; n < __listed[i]; n++)
+        {
+            if (!isMoved[__neighbours[i * __width + n]])
+            {
+                entries.push_back(std::make_pair(__separation[i * __width + n], __neighbours[i * __width + n]));
+            }
+        }
+        for (unsigned int m = 0; m < moved.size(); m++)
+        {
+            double d = std::sqrt(__distance(__centroids + i * __dims, __centroids + moved[m] * __dims, __dims));
+            if (d < __beyond[i])
+            {
+                entries.push_back(std::make_pair(d, moved[m]));
+            }
+        }
+        std::sort(entries.begin(), entries.end());
+
+        if (entries.size() > __width)
+        {
+            __beyond[i] = entries[__width].first;
+            entries.resize(__width);
+        }
+
+        // A list that lost most of its neighbours prunes poorly
+        if (entries.size() < __width / 2)
+        {
+            rebuildList(i);
+            return;
+        }
+
+        for (unsigned int n = 0; n < entries.size(); n++)
+        {
+            __separation[i * __width + n] = entries[n].first;
+            __neighbours[i * __width + n] = entries[n].second;
+        }
+        __listed[i] = entries.size();
+    }
+
+    void CentroidIndex::update(const std::vector<unsigned int> &moved, ThreadPool &pool)
+    {
+        if (moved.empty())
+        {
+            return;
+        }
+
+        std::vector<bool> isMoved(__clusters, false);
+        for (unsigned int m = 0; m < moved.size(); m++)
+        {
+            isMoved[moved[m]] = true;
+        }
+
+        pool.parallelFor(0, __clusters, 16, [&](unsigned int, unsigned int first, unsigned int last) {
+            for (unsigned int i = first; i < last; i++)
+            {
+                if (isMoved[i])
+                    rebuildList(i);
+                else
+                    updateList(i, moved, isMoved);
+            }
+        });
+    }
+
+    double CentroidIndex::separation(unsigned int centroid) const
+    {
+        return __listed[centroid] > 0 ? __separation[centroid * __width] : __beyond[centroid];
+    }
+
+    int CentroidIndex::nearest(const double *row, int start, double &distance, double *second) const
+    {
+        if (start < 0 || static_cast<unsigned int>(start) >= __clusters)
+        {
+            start = 0;
+        }
+
+        int best = start;
+        distance = __distance(row, __centroids + start * __dims, __dims);
+
+        // Least squared distance seen to a centroid other than the best, and
+        // the bound on all centroids a list scan stopped short of
+        double runnerUp = std::numeric_limits<double>::infinity();
+        double pruned = std::numeric_limits<double>::infinity();
+
+        // Scan the list of `current`; if the bound is never reached, move on
+        // to the closer centroid found and scan its list instead
+        bool bounded = false;
+        for (int current = start; ; current = best)
+        {
+            double reach = std::sqrt(distance);
+            unsigned int n = 0;
+            for ( ; n < __listed[current]; n++)
+            {
+                double apart = __separation[current * __width + n];
+                if (apart > reach + std::sqrt(distance))
+                {
+                    break;
+                }
+
+                int candidate = __neighbours[current * __width + n];
+                double d = __distance(row, __centroids + candidate * __dims, __dims);
+                if (d < distance || (d == distance && candidate < best))
+                {
+                    runnerUp = std::min(runnerUp, distance);
+                    distance = d;
+                    best = candidate;
+                }
+                else
+                {
+                    runnerUp = std::min(runnerUp, d);
+                }
+            }
+
+            // Every centroid not scanned here is at least this far from current
+            double apart = (n < __listed[current]) ? __separation[current * __width + n] : __beyond[current];
+            if (apart > reach + std::sqrt(distance))
+            {
+                pruned = apart - reach;
+                bounded = true;
+                break;
+            }
+
+            if (best == current)
+            {
+                break;
+            }
+        }
+
+        // No list bounds the search: scan every centroid
+        for (unsigned int i = 0; !bounded && i < __clusters; i++)
+        {
+            if (static_cast<int>(i) == best)
+            {
+                continue;
+            }
+
+            double d = __distance(row, __centroids + i * __dims, __dims);
+            if (d < distance || (d == distance && static_cast<int>(i) < best))
+            {
+                runnerUp = std::min(runnerUp, distance);
+                distance = d;
+                best = i;
+            }
+            else
+            {
+                runnerUp = std::min(runnerUp, d);
+            }
+        }
+
+        if (second != nullptr)
+        {
+            *second = std::min(std::sqrt(runnerUp), pruned);
+        }
+
+        return best;
+    }
+
+}
@@ -0,0 +1,68 @@
+// Nearest-centroid queries that skip most centroids when k is large.
+// Each centroid keeps its nearest other centroids sorted by distance, and
+// a bound no unlisted centroid is closer than. For a point x and a start
+// centroid c, any centroid z closer to x than the best b found so far has
+// |c - z| <= |x - c| + |x - b|, so the scan of c's list stops at the first
+// neighbour beyond that bound; the result is the same centroid a full
+// scan picks.
+//
+// Between iterations most centroids stay where they are. update() only
+// measures the distances to the ones that moved, so the lists are kept up
+// to date at O(k m dims) for m moved centroids instead of O(k^2 dims).
+
+#ifndef CLUSTERING_CENTROIDINDEX_H
+#define CLUSTERING_CENTROIDINDEX_H
+
+#include "FixedPoint.h"
+#include "ThreadPool.h"
+#include <vector>
+
+namespace Clustering {
+
+    class CentroidIndex {
+        unsigned int __dims;
+        unsigned int __clusters;
+        unsigned int __width; // neighbours kept per centroid, at most
+        const double *__centroids;
+        std::vector<unsigned int> __neighbours; // __width slots per centroid, nearest first
+        std::vector<double> __separation;       // distance to each of them
+        std::vector<unsigned int> __listed;     // slots in use per centroid
+        std::vector<double> __beyond;           // no unlisted centroid is closer
+        DistanceKernel __distance;
+
+        void rebuildList(unsigned int centroid);
+        void updateList(unsigned int centroid, const std::vector<unsigned int> &moved,
+                        const std::vector<bool> &isMoved);
+
+    public:
+        // Neighbours kept per centroid; a scan that runs past them falls
+        // back to the remaining centroids, so the result stays exact
+        static constexpr unsigned int MAX_NEIGHBOURS = 64;
+
+        CentroidIndex(unsigned int dims);
+
+        // Indexes k centroid rows, k x dims. The rows are not copied; they
+        // may only change as announced to update(). O(k^2 dims), split by
+        // centroid over the pool.
+        void rebuild(const double *centroids, unsigned int k, ThreadPool &pool = *ThreadPool::shared());
+
+        // The rows of the listed centroids were changed in place. Their own
+        // lists are rebuilt, all others only measure the moved centroids.
+        void update(const std::vector<unsigned int> &moved, ThreadPool &pool = *ThreadPool::shared());
+
+        unsigned int getClusters() const { return __clusters; }
+
+        // Distance (not squared) from a centroid to its nearest other
+        // centroid, infinity if there is none
+        double separation(unsigned int centroid) const;
+
+        // Index of the centroid closest to row, ties to the lowest index;
+        // start is a first guess, e.g. the row's previous cluster. The
+        // squared distance is left in distance and, if second is given, a
+        // lower bound on the distance (not squared) to every other centroid.
+        int nearest(const double *row, int start, double &distance, double *second = nullptr) const;
+    };
+
+}
+
+#endif //CLUSTERING_CENTROIDINDEX_H
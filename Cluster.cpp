@@ -1,176 +1,101 @@
 #include "Cluster.h"
+#include "SparseStore.h"
 #include <iostream>
 #include <string>
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <utility>
+#include <limits>
+#include <unordered_set>
+#include <memory>
+#include <map>
+#include <set>
 
 using namespace Clustering;
 using namespace std;
 
 namespace Clustering {
 
-    Cluster::Cluster(const Cluster &other) : __centroid(other.getCentroid()), pointdimensions(other.getId()), __centroidvalidity(false)
+    // Copies share the LNode chain until one of them is modified
+    Cluster::Cluster(const Cluster &other) : size(other.size), points(other.points), __id(other.getId()),
+                                             __centroid(other.getCentroid()), __centroidvalidity(false),
+                                             __centroidmean(false),
+                                             pointdimensions(other.pointdimensions),
+                                             __indexDataset(other.__indexDataset), __membership(other.__membership),
+                                             __untracked(other.__untracked), __repeats(other.__repeats),
+                                             __share(other.__share)
     {
-        __id = other.getId();
 
-        if(other.points == nullptr)
+    }
+
+    Cluster& Cluster::operator=(const Cluster &other)
+    {
+        if(this == &other)
         {
-            size = other.size;
-            points = nullptr;
-            return;
+            return *this;
         }
-        size = other.size;
-        points = new LNode;
-        LNodePtr current = points;
-        LNodePtr othercurrent = other.points;
 
-        for( ; othercurrent != nullptr; current = current->next)
+        if(__share.use_count() == 1)
         {
-            current->p = othercurrent->p;
-            othercurrent = othercurrent->next;
-            if(othercurrent != nullptr)
-            {
-                current->next = new LNode;
-            }
-            else
-            {
-                current->next = nullptr;
-                return;
-            }
+            releaseChain();
         }
 
+        size = other.size;
+        points = other.points;
+        __share = other.__share;
+        __id = other.getId();
+        __centroid = other.getCentroid();
+        __centroidvalidity = false;
+        __centroidmean = false;
+        pointdimensions = other.pointdimensions;
+        __indexDataset = other.__indexDataset;
+        __membership = other.__membership;
+        __untracked = other.__untracked;
+        __repeats = other.__repeats;
+
+        return *this;
     }
 
-    Cluster& Cluster::operator=(const Cluster &other)
+    Cluster::~Cluster()
     {
-        if(points == nullptr)
+        if(__share.use_count() == 1)
         {
-            if(other.points == nullptr)
-            {
-                __id = other.getId();
-                return *this;
-            }
-            size = other.size;
-            points = new LNode;
-            LNodePtr current = points;
-            LNodePtr othercurrent = other.points;
-
-            for( ; othercurrent != nullptr; current = current->next)
-            {
-                current->p = othercurrent->p;
-                othercurrent = othercurrent->next;
-                if(othercurrent != nullptr)
-                {
-                    current->next = new LNode;
-                }
-                else
-                {
-                    current->next = nullptr;
-                    return *this;
-                }
-            }
+            releaseChain();
         }
-        else
-        {
-          LNodePtr current = points;
-            LNodePtr prev = points;
-            for( ; current != nullptr; current = current->next)
-            {
-                if(current->next == nullptr)
-                {
-                    if(current == prev)
-                    {
-                        delete points;
-                        size--;
-                        points = nullptr;
-                        current = points;
-                        break;
-                    }
-                    else
-                    {
-                        delete current;
-                        prev->next = nullptr;
-                        size--;
-                        prev = points;
-                        current = points;
-                    }
-                }
-                else
-                {
-                    if(current != prev)
-                    {
-                        prev = prev->next;
-                    }
-                }
-
-            }
-            delete prev;
-            points = nullptr;
-            size--;
-            if(points == nullptr)
-            {
-                if (other.points == nullptr)
-                {
-                    return *this;
-                }
-                size = other.size;
-                points = new LNode;
-                LNodePtr current = points;
-                LNodePtr othercurrent = other.points;
+    }
 
-                for (; othercurrent != nullptr; current = current->next)
-                {
-                    current->p = othercurrent->p;
-                    othercurrent = othercurrent->next;
-                    if (othercurrent != nullptr)
-                    {
-                        current->next = new LNode;
-                    }
-                    else
-                    {
-                        current->next = nullptr;
-                        return *this;
-                    }
-                }
-            }
+    // Frees this cluster's nodes (never the points)
+    void Cluster::releaseChain()
+    {
+        while(points != nullptr)
+        {
+            LNodePtr next = points->next;
+            delete points;
+            points = next;
         }
     }
 
-    Cluster::~Cluster()
+    // Gives this cluster a private copy of a shared chain before it is modified
+    void Cluster::detach()
     {
-        for(int i = 0; i < size; i++)
+        if(__share.use_count() == 1)
         {
-            if(points == nullptr)
-            {
-                return;
-            }
-            else
-            {
-                LNodePtr cursor2 = points;
-                LNodePtr temp = points;
-                for(int i2 = 0; i2 < size; i++)
-                {
-                    if(cursor2->next == nullptr)
-                    {
-
-                        delete cursor2;
-                        --size;
-                        cursor2 = points;
-                        for(int i3 = 0; i3 < size - 1; i3++)
-                        {
-                            cursor2 = cursor2->next;
-                        }
-                        cursor2->next = nullptr;
+            return;
+        }
 
-                    }
-                    else
-                    {
-                        cursor2 = cursor2 -> next;
-                    }
-                }
-            }
+        LNodePtr copy = nullptr;
+        LNodePtr *link = &copy;
+        for(LNodePtr current = points; current != nullptr; current = current->next)
+        {
+            *link = new LNode;
+            (*link)->p = current->p;
+            (*link)->next = nullptr;
+            link = &(*link)->next;
         }
+
+        points = copy;
+        __share = std::make_shared<ChainShare>();
     }
 
 
@@ -189,7 +114,78 @@ namespace Clustering {
         from->__centroidvalidity = false;
     }
 
+    void Cluster::MoveBatch::add(const PointPtr &point, Cluster *cfrom, Cluster *cto)
+    {
+        if(cfrom != cto)
+        {
+            moves.push_back(Move(point, cfrom, cto));
+        }
+    }
+
+    // Applies all moves with one removeAll and one addAll per cluster. A
+    // cluster whose centroid was the mean of its members has it updated from
+    // the running sum (centroid * size - leaving + arriving); any other
+    // nonempty cluster gets its mean recomputed from scratch.
+    void Cluster::MoveBatch::perform()
+    {
+        std::map<Cluster *, std::vector<PointPtr> > outgoing, incoming;
+        for(unsigned int i = 0; i < moves.size(); i++)
+        {
+            outgoing[moves[i].from].push_back(moves[i].ptr);
+            incoming[moves[i].to].push_back(moves[i].ptr);
+        }
+
+        std::set<Cluster *> touched;
+        for(auto it = outgoing.begin(); it != outgoing.end(); ++it) touched.insert(it->first);
+        for(auto it = incoming.begin(); it != incoming.end(); ++it) touched.insert(it->first);
+
+        for(auto it = touched.begin(); it != touched.end(); ++it)
+        {
+            Cluster *cluster = *it;
+            const std::vector<PointPtr> &leaving = outgoing[cluster];
+            const std::vector<PointPtr> &arriving = incoming[cluster];
+
+            bool running = cluster->__centroidvalidity && cluster->__centroidmean &&
+                           cluster->__centroid.getDims() == static_cast<int>(cluster->pointdimensions);
+            Point sum(cluster->pointdimensions);
+            if(running)
+            {
+                sum.addScaled(cluster->__centroid, cluster->size);
+                for(unsigned int i = 0; i < leaving.size(); i++) sum -= *leaving[i];
+                for(unsigned int i = 0; i < arriving.size(); i++) sum += *arriving[i];
+            }
+
+            // removeAll drops every copy of a point listed more than once,
+            // the sum only one
+            int before = cluster->size;
+            cluster->removeAll(leaving);
+            running = running && (before - cluster->size == static_cast<int>(leaving.size()));
+            cluster->addAll(arriving);
+
+            if(cluster->size == 0)
+            {
+                continue;
+            }
+
+            if(running)
+            {
+                sum /= cluster->size;
+                cluster->setCentroid(sum);
+                cluster->__centroidmean = true;
+            }
+            else
+            {
+                cluster->computeCentroid();
+            }
+        }
+
+        moves.clear();
+    }
+
     void Cluster::add(const PointPtr &point) {
+        detach();
+        track(point);
+
         if (points == nullptr)
         {
             points = new LNode;
@@ -245,6 +241,41 @@ namespace Clustering {
 
     }
 
+    // Inserts many points at once: one sort of the new points and a single
+    // merge pass over the list, instead of a sorted insertion per point
+    void Cluster::addAll(const std::vector<PointPtr> &newpoints)
+    {
+        if (newpoints.empty())
+        {
+            return;
+        }
+
+        detach();
+
+        std::vector<unsigned int> order = lexicographicOrder(newpoints.data(), newpoints.size());
+
+        LNodePtr *link = &points;
+        for (unsigned int i = 0; i < order.size(); i++)
+        {
+            PointPtr point = newpoints[order[i]];
+
+            // existing equal points stay in front of the new one, as in add()
+            while (*link != nullptr && !(*(*link)->p > *point))
+            {
+                link = &(*link)->next;
+            }
+
+            LNodePtr node = new LNode;
+            node->p = point;
+            node->next = *link;
+            *link = node;
+            link = &node->next;
+            size++;
+            track(point);
+        }
+        __centroidvalidity = false;
+    }
+
     const PointPtr& Cluster::remove(const PointPtr &point)
     {
         if(points == nullptr)
@@ -252,12 +283,15 @@ namespace Clustering {
             return point;
         }
 
+        detach();
+
         LNodePtr current = points;
         LNodePtr prev = points;
         for( ; current != nullptr; current = current->next)
         {
             if(current->p == point)
             {
+                untrack(point);
                 if(current == prev)
                 {
                     points = prev->next;
@@ -283,6 +317,8 @@ namespace Clustering {
                 }
             }
         }
+
+        return point;
     }
 
     std::ostream &operator<<(std::ostream &os, const Cluster &ctemp) {
@@ -313,6 +349,7 @@ namespace Clustering {
 
     std::istream &operator>>(std::istream &is, Cluster &ctemp)
     {
+        std::vector<PointPtr> loaded;
         string line;
         while(getline(is, line))
         {
@@ -328,13 +365,27 @@ namespace Clustering {
 
             countDelim = count(line.begin(), line.end(), ',') + 1;
 
-            if(countDelim == ctemp.pointdimensions)
+            if(line.find(':') != string::npos)
+            {
+                // sparse "index:value" line, unlisted coordinates are zero
+                SparseStore::Entries entries;
+                if(SparseStore::parseRow(line, ctemp.pointdimensions, entries))
+                {
+                    PointPtr p = new Point(ctemp.pointdimensions);
+                    for(unsigned int e = 0; e < entries.size(); e++)
+                    {
+                        p->setValue(entries[e].first + 1, entries[e].second);
+                    }
+                    loaded.push_back(p);
+                }
+            }
+            else if(countDelim == ctemp.pointdimensions)
             {
                 PointPtr p = new Point(ctemp.pointdimensions);
 
                 linestream >> *p;
 
-                ctemp.add(p);
+                loaded.push_back(p);
             }
 //            else
 //            {
@@ -343,10 +394,22 @@ namespace Clustering {
 //            }
         }
 
+        // one sort for the whole file instead of a sorted insertion per line
+        ctemp.addAll(loaded);
+
+        return is;
     }
 
     bool operator==(const Cluster &lhs, const Cluster &rhs)
     {
+        // Both sides fully covered by bitmaps of the same dataset
+        if(lhs.hasMembershipIndex() && rhs.hasMembershipIndex() &&
+           lhs.__indexDataset == rhs.__indexDataset && lhs.__untracked == 0 && rhs.__untracked == 0 &&
+           lhs.__repeats.empty() && rhs.__repeats.empty())
+        {
+            return lhs.size == rhs.size && lhs.__membership == rhs.__membership;
+        }
+
         bool result;
         LNodePtr lhcursor = lhs.points;
         LNodePtr rhcursor = rhs.points;
@@ -387,43 +450,37 @@ namespace Clustering {
         return result;
     }
 
+    // Union through a hashed membership index: O(n + m) plus one sort of the
+    // points actually added
     Cluster& Cluster::operator+=(const Cluster &rhs)
     {
-        if(rhs.points == nullptr)
+        if(rhs.points == nullptr || &rhs == this)
         {
             return *this;
         }
 
-        LNodePtr current = points;
-        LNodePtr rhscurrent = rhs.points;
-
-        for( ; rhscurrent != nullptr; rhscurrent = rhscurrent->next)
+        std::unordered_set<PointPtr> members;
+        members.reserve(size + rhs.size);
+        for(LNodePtr current = points; current != nullptr; current = current->next)
         {
-            bool result = false;
-            for( ; current !=nullptr; current = current->next)
-            {
-
-                if(current == nullptr)
-                {
-                    break;
-                }
-                if(current->p == rhscurrent->p)
-                {
-                    result = true;
-                    break;
-                }
+            members.insert(current->p);
+        }
 
-            }
-            if(result == false)
+        std::vector<PointPtr> missing;
+        for(LNodePtr rhscurrent = rhs.points; rhscurrent != nullptr; rhscurrent = rhscurrent->next)
+        {
+            if(members.insert(rhscurrent->p).second)
             {
-                add(rhscurrent->p);
+                missing.push_back(rhscurrent->p);
             }
-            current = points;
         }
 
+        addAll(missing);
+
         return *this;
     }
 
+    // Difference in one pass over the list, checking a hashed index of rhs
     Cluster& Cluster::operator-=(const Cluster &rhs)
     {
         if(rhs.points == nullptr)
@@ -431,30 +488,47 @@ namespace Clustering {
             return *this;
         }
 
-        LNodePtr current = points;
-        LNodePtr rhscurrent = rhs.points;
+        std::vector<PointPtr> removed;
+        removed.reserve(rhs.size);
+        for(LNodePtr rhscurrent = rhs.points; rhscurrent != nullptr; rhscurrent = rhscurrent->next)
+        {
+            removed.push_back(rhscurrent->p);
+        }
+
+        removeAll(removed);
 
-        for( ; rhscurrent != nullptr; rhscurrent = rhscurrent->next)
+        return *this;
+    }
+
+    // Removes many points at once in a single pass over the list
+    void Cluster::removeAll(const std::vector<PointPtr> &oldpoints)
+    {
+        if(oldpoints.empty() || points == nullptr)
         {
+            return;
+        }
 
-            for( ; current !=nullptr; current = current->next)
-            {
+        std::unordered_set<PointPtr> removed(oldpoints.begin(), oldpoints.end());
 
-                if(current == nullptr)
-                {
-                    break;
-                }
-                if(current->p == rhscurrent->p)
-                {
-                    remove(rhscurrent->p);
-                    break;
-                }
+        detach();
 
+        LNodePtr *link = &points;
+        while(*link != nullptr)
+        {
+            if(removed.count((*link)->p) > 0)
+            {
+                LNodePtr current = *link;
+                *link = current->next;
+                untrack(current->p);
+                delete current;
+                size--;
+                __centroidvalidity = false;
+            }
+            else
+            {
+                link = &(*link)->next;
             }
-            current = points;
         }
-
-        return *this;
     }
 
 
@@ -474,12 +548,15 @@ namespace Clustering {
             return *this;
         }
 
+        detach();
+
         LNodePtr current = points;
         LNodePtr prev = points;
         for( ; current != nullptr; current = current->next)
         {
             if(current->p == &rhs)
             {
+                untrack(current->p);
                 if(current == prev)
                 {
                     points = prev->next;
@@ -505,6 +582,8 @@ namespace Clustering {
                 }
             }
         }
+
+        return *this;
     }
 
     const Cluster operator+(const Cluster &lhs, const PointPtr &rhs)
@@ -543,11 +622,11 @@ namespace Clustering {
         return result;
     }
 
+    std::atomic<unsigned int> Cluster::__idGenerator(1);
+
     unsigned int Cluster::generateid()
     {
-        static unsigned int tempid = 0;
-        tempid++;
-        return tempid;
+        return __idGenerator.fetch_add(1, std::memory_order_relaxed);
     }
 
    unsigned int Cluster::getId()const {
@@ -563,10 +642,11 @@ namespace Clustering {
     {
             __centroid = point;
         __centroidvalidity = true;
+        __centroidmean = false;
         return;
     }
 
-    const Point Cluster::getCentroid() const
+    const Point &Cluster::getCentroid() const
     {
         return __centroid;
     }
@@ -577,15 +657,20 @@ namespace Clustering {
         Point p(pointdimensions);
         while(np != nullptr)
         {
-            p += *np->p / size;
+            p += *np->p;
             np = np->next;
         }
-        __centroid = p;
+        if(size > 0)
+        {
+            p /= size;
+        }
+        __centroid = std::move(p);
         __centroidvalidity = true;
+        __centroidmean = true;
     }
 
 
-    void Cluster::pickPoints(unsigned int k, PointPtr *pointArray)
+    std::vector<std::unique_ptr<Point> > Cluster::pickPoints(unsigned int k, PointPtr *pointArray)
     {
         LNodePtr current = points;
         int index = 0;
@@ -599,6 +684,20 @@ namespace Clustering {
 
 
         }
+
+        // Not enough points: the remaining centroids are new points "at infinity"
+        std::vector<std::unique_ptr<Point> > placeholders;
+        for( ; index < k; index++)
+        {
+            placeholders.emplace_back(new Point(pointdimensions));
+            for(int i = 0; i < pointdimensions; i++)
+            {
+                (*placeholders.back())[i + 1] = std::numeric_limits<double>::max();
+            }
+            pointArray[index] = placeholders.back().get();
+        }
+
+        return placeholders;
     }
 
 
@@ -634,7 +733,7 @@ namespace Clustering {
         LNodePtr c1current = c1.points;
          LNodePtr c2current = c2.points;
         double distance;
-        double sum;
+        double sum = 0;
 
         if(c1current == nullptr || c2current == nullptr)
         {
@@ -694,6 +793,11 @@ namespace Clustering {
 
     bool Cluster::contains(const PointPtr &ptr) const
     {
+        if(hasMembershipIndex() && isTracked(*ptr))
+        {
+            return __membership.test(ptr->getIndex());
+        }
+
         LNodePtr temp = points;
 
         while(temp != nullptr)
@@ -714,4 +818,72 @@ namespace Clustering {
         return false;
     }
 
-}
\ No newline at end of file
+    bool Cluster::isTracked(const Point &point) const
+    {
+        return point.getDataset() == __indexDataset && point.getIndex() >= 0 &&
+               static_cast<unsigned int>(point.getIndex()) < __membership.capacity();
+    }
+
+    void Cluster::track(const PointPtr &point)
+    {
+        if(!hasMembershipIndex())
+        {
+            return;
+        }
+
+        if(isTracked(*point))
+        {
+            if(__membership.test(point->getIndex()))
+            {
+                __repeats[point->getIndex()]++;
+            }
+            else
+            {
+                __membership.set(point->getIndex());
+            }
+        }
+        else
+        {
+            __untracked++;
+        }
+    }
+
+    void Cluster::untrack(const PointPtr &point)
+    {
+        if(!hasMembershipIndex())
+        {
+            return;
+        }
+
+        if(isTracked(*point))
+        {
+            std::unordered_map<unsigned int, unsigned int>::iterator repeat = __repeats.find(point->getIndex());
+            if(repeat == __repeats.end())
+            {
+                __membership.reset(point->getIndex());
+            }
+            else if(--repeat->second == 0)
+            {
+                __repeats.erase(repeat);
+            }
+        }
+        else
+        {
+            __untracked--;
+        }
+    }
+
+    void Cluster::indexMembership(unsigned int dataset, unsigned int datasetsize)
+    {
+        __indexDataset = dataset;
+        __membership = Bitmap(datasetsize);
+        __untracked = 0;
+        __repeats.clear();
+
+        for(LNodePtr current = points; current != nullptr; current = current->next)
+        {
+            track(current->p);
+        }
+    }
+
+}
@@ -2,7 +2,11 @@
 #define CLUSTERING_CLUSTER_H
 
 #include "Point.h"
+#include "Bitmap.h"
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
 //
 namespace Clustering {
 
@@ -19,34 +23,82 @@ namespace Clustering {
 
 
 
+    // Token held by every Cluster viewing the same LNode chain. A shared
+    // chain is copied on the first modification (copy-on-write).
+    struct ChainShare {};
+
     class Cluster {
         int size;
         LNodePtr points;
         bool __release_points;
         unsigned int __id;
-        static unsigned int __idGenerator;
+        static std::atomic<unsigned int> __idGenerator;
         Point __centroid;
         bool __centroidvalidity;
+        // The centroid is the mean of the members, not a value from
+        // setCentroid(); only then can MoveBatch update it from a running sum
+        bool __centroidmean;
         unsigned int pointdimensions;
 
+        // Optional membership bitmap over the point indices of one dataset
+        unsigned int __indexDataset = 0;
+        Bitmap __membership;
+        unsigned int __untracked = 0; // members the bitmap does not cover
+        // Occurrences beyond the first of a point listed more than once; its
+        // bit is only cleared when the last occurrence is removed
+        std::unordered_map<unsigned int, unsigned int> __repeats;
+
+        bool isTracked(const Point &) const;
+        void track(const PointPtr &);
+        void untrack(const PointPtr &);
+
+        std::shared_ptr<ChainShare> __share = std::make_shared<ChainShare>();
+        void detach();
+        void releaseChain();
+
     public:
-        Cluster() : size(0), points(nullptr), __id(generateid()), __centroid(pointdimensions = 5), __centroidvalidity(false) {};
-        Cluster(unsigned int dimensions) : size(0), points(nullptr), __id(generateid()), pointdimensions(dimensions), __centroid(dimensions), __centroidvalidity(false) {};
+        // A private sequence of ids. Clusters built from one IdSpace are
+        // numbered 1, 2, ... independently of every other thread or run.
+        class IdSpace {
+            std::atomic<unsigned int> __next;
+        public:
+            IdSpace() : __next(1) {}
+            unsigned int next() { return __next.fetch_add(1, std::memory_order_relaxed); }
+        };
+
+        Cluster() : size(0), points(nullptr), __id(generateid()), __centroid(pointdimensions = 5), __centroidvalidity(false), __centroidmean(false) {};
+        Cluster(unsigned int dimensions) : size(0), points(nullptr), __id(generateid()), pointdimensions(dimensions), __centroid(dimensions), __centroidvalidity(false), __centroidmean(false) {};
+        Cluster(unsigned int dimensions, IdSpace &ids) : size(0), points(nullptr), __id(ids.next()), pointdimensions(dimensions), __centroid(dimensions), __centroidvalidity(false), __centroidmean(false) {};
         // The big three: cpy ctor, overloaded operator=, dtor
         Cluster(const Cluster &);
         Cluster &operator=(const Cluster &);
         ~Cluster();
 
+        class MoveBatch;
+
         class Move{
             PointPtr ptr;
             Cluster *to, *from;
+            friend class MoveBatch;
         public:
             void perform();
             Move(const PointPtr &, Cluster *, Cluster *);
         };
 
+        // Collects the reassignments of a whole sweep and applies them
+        // together; each point may appear in at most one move per batch
+        class MoveBatch{
+            std::vector<Move> moves;
+        public:
+            void add(const PointPtr &, Cluster *from, Cluster *to);
+            void perform();
+            unsigned int size() const { return moves.size(); }
+        };
+
         // Set functions: They allow calling c1.add(c2.remove(p));
         void add(const PointPtr &);
+        void addAll(const std::vector<PointPtr> &); // bulk add, sorts once
+        void removeAll(const std::vector<PointPtr> &); // bulk remove, one pass
         const PointPtr &remove(const PointPtr &);
 
         // Overloaded operators
@@ -74,18 +126,21 @@ namespace Clustering {
         friend const Cluster operator+(const Cluster &lhs, const PointPtr &rhs);
         friend const Cluster operator-(const Cluster &lhs, const PointPtr &rhs);
 
-        static unsigned int generateid();
+        static unsigned int generateid(); // process-wide, safe to call from any thread
         unsigned int getId()const;
 
         int getSize();
 
         void setCentroid(const Point &);
 
-        const Point getCentroid() const;
+        const Point &getCentroid() const;
 
         void computeCentroid();
 
-        void pickPoints(unsigned int k, PointPtr *pointArray);
+        // Fills pointArray with k members; with fewer members the rest point
+        // at placeholders "at infinity", owned by the returned vector, so it
+        // has to outlive pointArray's use of them
+        std::vector<std::unique_ptr<Point> > pickPoints(unsigned int k, PointPtr *pointArray);
 
         double intraClusterDistance() const;
 
@@ -105,6 +160,11 @@ namespace Clustering {
 
         bool contains(const PointPtr &ptr) const;
 
+        // Makes contains() and operator== word operations for points indexed
+        // in the given dataset (see Point::setIndex)
+        void indexMembership(unsigned int dataset, unsigned int datasetsize);
+        bool hasMembershipIndex() const { return __membership.capacity() > 0; }
+
     };
 
 
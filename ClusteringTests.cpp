@@ -10,11 +10,29 @@
 #include <cmath>
 #include <map>
 #include <regex>
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <cstdio>
+#include <ctime>
 
 #include "ClusteringTests.h"
 #include "Point.h"
 #include "Cluster.h"
 #include "KMeans.h"
+#include "FixedPoint.h"
+#include "ThreadPool.h"
+#include "NumaTopology.h"
+#include "Reduction.h"
+#include "KdTree.h"
+#include "CentroidIndex.h"
+#include "ProductQuantizer.h"
+#include "RandomProjection.h"
+#include "SparseStore.h"
 
 using namespace Clustering;
 using namespace Testing;
@@ -511,6 +529,93 @@ void test_point_comparison(ErrorContext &ec, unsigned int numRuns) {
     }
 }
 
+// compare, lexicographicOrder
+void test_point_sort(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - Point - Lexicographic sort ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("less than or equal, later coordinate decides");
+
+        {
+            Point p1(5), p2(5);
+
+            for (int i = 0; i < 5; i++)
+                p1[i + 1] = p2[i + 1] = i;
+            p1[4] = 10;
+
+            pass = !(p1 <= p2) && (p2 <= p1) && (p1 >= p2) && !(p2 >= p1) &&
+                   (compare(p1, p2) > 0) && (compare(p2, p2) == 0);
+            ec.result(pass);
+        }
+
+        ec.DESC("parallel order matches sequential order");
+
+        {
+            const unsigned int n = 20000;
+            std::vector<PointPtr> points;
+
+            for (unsigned int i = 0; i < n; i++) {
+                PointPtr ptr = new Point(3);
+                (*ptr)[1] = (i * 7919) % 13;
+                (*ptr)[2] = (i * 104729) % 101;
+                (*ptr)[3] = i % 7;
+                points.push_back(ptr);
+            }
+
+            std::vector<unsigned int> seq = lexicographicOrder(points.data(), n, 1),
+                                      par = lexicographicOrder(points.data(), n, 4);
+
+            pass = (seq == par);
+            for (unsigned int i = 1; i < n; i++)
+                pass = pass && (*points[par[i - 1]] <= *points[par[i]]);
+
+            for (unsigned int i = 0; i < n; i++) delete points[i];
+
+            ec.result(pass);
+        }
+
+        ec.DESC("Cluster addAll matches repeated add");
+
+        {
+            Cluster c1(3), c2(3);
+            std::vector<PointPtr> points;
+
+            for (int i = 0; i < 50; i++) {
+                PointPtr ptr = new Point(3);
+                (*ptr)[1] = (i * 31) % 5;
+                (*ptr)[2] = (i * 17) % 11;
+                (*ptr)[3] = i;
+                points.push_back(ptr);
+            }
+
+            for (int i = 0; i < 25; i++) {
+                c1.add(points[i]);
+                c2.add(points[i]);
+            }
+            for (int i = 25; i < 50; i++) c1.add(points[i]);
+            c2.addAll(std::vector<PointPtr>(points.begin() + 25, points.end()));
+
+            pass = (c1.getSize() == 50) && (c2.getSize() == 50);
+            for (int i = 0; i < 50; i++)
+                pass = pass && (c1[i] == c2[i]);
+
+            for (int i = 0; i < 50; i++) {
+                c1.remove(points[i]);
+                c2.remove(points[i]);
+                delete points[i];
+            }
+
+            ec.result(pass);
+        }
+    }
+}
+
 // operator+=, operator-=, operator*=, operator/=
 void test_point_CAO(ErrorContext &ec, unsigned int numRuns) {
     bool pass;
@@ -683,6 +788,119 @@ void test_point_SAO(ErrorContext &ec, unsigned int numRuns) {
     }
 }
 
+// Move construction/assignment, in-place arithmetic
+void test_point_move(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - Point - Move semantics ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("move constructor and move assignment");
+
+        {
+            Point p1(50);
+            for (int i = 0; i < 50; i++)
+                p1[i + 1] = 2.5 * i;
+
+            const double *coords = p1.data();
+
+            Point p2(std::move(p1));
+            pass = (p2.getDims() == 50) && (p2.data() == coords) && (p1.getDims() == 0);
+
+            Point p3(10);
+            p3 = std::move(p2);
+            pass = pass && (p3.getDims() == 50) && (p3.data() == coords) && (p3[50] == 2.5 * 49);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("chained arithmetic reuses the temporary");
+
+        {
+            Point p1(50), p2(50), p3(50);
+            for (int i = 0; i < 50; i++) {
+                p1[i + 1] = i;
+                p2[i + 1] = 2 * i;
+                p3[i + 1] = 3 * i;
+            }
+
+            Point p4 = (p1 + p2 + p3) / 2.0 * 4.0;
+
+            pass = true;
+            for (int i = 0; i < 50; i++)
+                pass = pass && (p4[i + 1] == 12 * i);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("addScaled");
+
+        {
+            Point p1(3), p2(3);
+            for (int i = 0; i < 3; i++) {
+                p1[i + 1] = 1.0;
+                p2[i + 1] = i;
+            }
+
+            p1.addScaled(p2, 0.5);
+
+            pass = (p1[1] == 1.0) && (p1[2] == 1.5) && (p1[3] == 2.0);
+
+            ec.result(pass);
+        }
+    }
+}
+
+// Inline (small-buffer) coordinate storage
+void test_point_inline(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - Point - Inline storage ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("low dimensions inline, high dimensions on the heap");
+
+        {
+            Point p1(Point::INLINE_DIMS), p2(Point::INLINE_DIMS + 1);
+
+            pass = p1.isInline() && !p2.isInline();
+
+            ec.result(pass);
+        }
+
+        ec.DESC("copy, move and assign across storage kinds");
+
+        {
+            Point small(3), large(50);
+            for (int i = 0; i < 3; i++) small[i + 1] = i + 0.5;
+            for (int i = 0; i < 50; i++) large[i + 1] = i + 0.25;
+
+            Point c1(small);
+            Point c2(std::move(c1));
+            Point c3(large);
+
+            c3 = c2;          // heap -> inline
+            pass = c3.isInline() && (c3 == small) && (c2 == small);
+
+            c3 = Point(large); // inline -> heap, moved
+            pass = pass && !c3.isInline() && (c3 == large);
+
+            c3 = Point(small); // heap -> inline, moved
+            pass = pass && c3.isInline() && (c3 == small);
+
+            ec.result(pass);
+        }
+    }
+}
+
 // distanceTo
 void test_point_distance(ErrorContext &ec, unsigned int numRuns) {
     bool pass;
@@ -746,6 +964,60 @@ void test_point_distance(ErrorContext &ec, unsigned int numRuns) {
     }
 }
 
+// FixedPoint<D> kernels vs. the generic loop
+void test_point_fixeddims(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - Point - Fixed-dimension kernels ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("specialized and generic distance agree");
+
+        {
+            unsigned int dims[] = { 1, 2, 3, 4, 5, 8, 16, 32, 64, 65 };
+
+            pass = true;
+            for (int d = 0; d < 10; d++) {
+                Point p1(dims[d]), p2(dims[d]);
+
+                for (int i = 0; i < dims[d]; i++) {
+                    p1[i + 1] = 1.5 * i * i + 0.25;
+                    p2[i + 1] = 3.0 * i + 1.0;
+                }
+
+                double expected = 0;
+                for (int i = 0; i < dims[d]; i++)
+                    expected += (p1[i + 1] - p2[i + 1]) * (p1[i + 1] - p2[i + 1]);
+
+                pass = pass &&
+                       (selectDistanceKernel(dims[d])(p1.data(), p2.data(), dims[d]) == expected) &&
+                       (p1.distanceTo(p2) == sqrt(expected));
+            }
+            ec.result(pass);
+        }
+
+        ec.DESC("FixedPoint<3> arithmetic");
+
+        {
+            FixedPoint<3> f1 = { { 1.0, 2.0, 3.0 } },
+                          f2 = { { 0.5, 0.5, 0.5 } };
+
+            f1 += f2;
+            f1 *= 2.0;
+
+            pass = (f1.coords[0] == 3.0) &&
+                   (f1.coords[1] == 5.0) &&
+                   (f1.coords[2] == 7.0) &&
+                   (f1.distanceSquaredTo(f1) == 0.0);
+            ec.result(pass);
+        }
+    }
+}
+
 // operator>>, operator<< (incl. exceptions)
 void test_point_IO(ErrorContext &ec, unsigned int numRuns) {
     bool pass;
@@ -1054,6 +1326,168 @@ void test_cluster_copying(ErrorContext &ec, unsigned int numRuns) {
     }
 }
 
+// Inner class MoveBatch
+void test_cluster_movebatch(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - Cluster - Move batch ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("batched moves between three clusters");
+
+        {
+            Cluster c1(3), c2(3), c3(3);
+            PointPtr points[12];
+
+            for (int i = 0; i < 12; i++) {
+                points[i] = new Point(3);
+                for (int j = 0; j < 3; j++) (*points[i])[j + 1] = i * 1.5 + j;
+                if (i < 6) c1.add(points[i]); else c2.add(points[i]);
+            }
+            c1.computeCentroid(); c2.computeCentroid(); c3.computeCentroid();
+
+            Cluster::MoveBatch batch;
+            batch.add(points[0], &c1, &c2);
+            batch.add(points[1], &c1, &c3);
+            batch.add(points[7], &c2, &c3);
+            batch.add(points[8], &c2, &c1);
+            batch.add(points[9], &c2, &c2); // no-op
+
+            pass = (batch.size() == 4);
+
+            batch.perform();
+
+            pass = pass && (batch.size() == 0) &&
+                   (c1.getSize() == 5) && (c2.getSize() == 5) && (c3.getSize() == 2) &&
+                   c2.contains(points[0]) && c3.contains(points[1]) &&
+                   c3.contains(points[7]) && c1.contains(points[8]) && !c1.contains(points[0]);
+
+            // running-sum centroids match a full recompute
+            Point running1 = c1.getCentroid(), running2 = c2.getCentroid();
+            pass = pass && c1.isCentroidValid() && c2.isCentroidValid();
+            c1.computeCentroid(); c2.computeCentroid();
+            for (int j = 0; j < 3; j++)
+                pass = pass &&
+                       (std::abs(running1[j + 1] - c1.getCentroid().getValue(j + 1)) < 1e-9) &&
+                       (std::abs(running2[j + 1] - c2.getCentroid().getValue(j + 1)) < 1e-9);
+
+            // clean up
+            for (int i = 0; i < 12; i++) {
+                c1.remove(points[i]); c2.remove(points[i]); c3.remove(points[i]);
+                delete points[i];
+            }
+
+            ec.result(pass);
+        }
+
+        ec.DESC("set centroids and duplicates are recomputed, not run");
+
+        {
+            Cluster seeded(2), doubled(2), other(2);
+            PointPtr points[4];
+
+            for (int i = 0; i < 4; i++) {
+                points[i] = new Point(2);
+                (*points[i])[1] = i;
+                (*points[i])[2] = 10 * i;
+            }
+
+            // A seed is not the mean of the members
+            seeded.add(points[0]); seeded.add(points[1]);
+            Point seed(2);
+            seed[1] = 100; seed[2] = 100;
+            seeded.setCentroid(seed);
+
+            // points[2] is listed twice; removing it drops both copies
+            doubled.add(points[2]); doubled.add(points[2]); doubled.add(points[3]);
+            doubled.computeCentroid();
+
+            Cluster::MoveBatch batch;
+            batch.add(points[1], &seeded, &other);
+            batch.add(points[2], &doubled, &other);
+            batch.perform();
+
+            pass = (seeded.getSize() == 1) && (doubled.getSize() == 1) && (other.getSize() == 2) &&
+                   seeded.isCentroidValid() && doubled.isCentroidValid() &&
+                   (seeded.getCentroid() == *points[0]) && (doubled.getCentroid() == *points[3]);
+
+            for (int i = 0; i < 4; i++) {
+                seeded.remove(points[i]); doubled.remove(points[i]); other.remove(points[i]);
+                delete points[i];
+            }
+
+            ec.result(pass);
+        }
+    }
+}
+
+// Copy-on-write snapshots
+void test_cluster_snapshot(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - Cluster - Copy-on-write snapshots ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("copies share storage until modified");
+
+        {
+            Cluster c1(10);
+            PointPtr p1 = new Point(10), p2 = new Point(10), p3 = new Point(10);
+            (*p2)[1] = 1; (*p3)[1] = 2;
+            c1.add(p1); c1.add(p2);
+
+            Cluster c2(c1), c3(10);
+            c3 = c1;
+
+            pass = (c2.getheadpointer() == c1.getheadpointer()) &&
+                   (c3.getheadpointer() == c1.getheadpointer());
+
+            c2.add(p3);
+            pass = pass && (c2.getheadpointer() != c1.getheadpointer()) &&
+                   (c1.getSize() == 2) && (c2.getSize() == 3) && (c3.getSize() == 2) &&
+                   !c1.contains(p3) && c2.contains(p3);
+
+            c1.remove(p1);
+            pass = pass && (c1.getSize() == 1) && c3.contains(p1) && c2.contains(p1);
+
+            // clean up
+            c1.remove(p2);
+            c2.remove(p1); c2.remove(p2); c2.remove(p3);
+            c3.remove(p1); c3.remove(p2);
+            delete p1; delete p2; delete p3;
+
+            ec.result(pass);
+        }
+
+        ec.DESC("snapshot survives the original");
+
+        {
+            PointPtr p1 = new Point(5);
+            Cluster *snapshot;
+            {
+                Cluster c1(5);
+                c1.add(p1);
+                snapshot = new Cluster(c1);
+            }
+
+            pass = (snapshot->getSize() == 1) && snapshot->contains(p1) && ((*snapshot)[0] == p1);
+
+            delete snapshot;
+            delete p1;
+
+            ec.result(pass);
+        }
+    }
+}
+
 // operator=
 void test_cluster_assignment(ErrorContext &ec, unsigned int numRuns) {
     bool pass;
@@ -1520,6 +1954,56 @@ void test_cluster_SAO(ErrorContext &ec, unsigned int numRuns) {
     }
 }
 
+// operator+=, operator-= on large clusters
+void test_cluster_setops(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - Cluster - Large set operations ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("union and difference of overlapping clusters");
+
+        {
+            const int n = 3000;
+            Cluster c1(3), c2(3);
+            std::vector<PointPtr> points;
+
+            for (int i = 0; i < n; i++) {
+                PointPtr ptr = new Point(3);
+                (*ptr)[1] = i % 17;
+                (*ptr)[2] = i;
+                points.push_back(ptr);
+            }
+
+            // c1 holds [0, 2n/3), c2 holds [n/3, n)
+            c1.addAll(std::vector<PointPtr>(points.begin(), points.begin() + 2 * n / 3));
+            c2.addAll(std::vector<PointPtr>(points.begin() + n / 3, points.end()));
+
+            c1 += c2;
+            pass = (c1.getSize() == n);
+            for (int i = 1; i < n; i++)
+                pass = pass && (*c1[i - 1] <= *c1[i]);
+
+            c1 -= c2;
+            pass = pass && (c1.getSize() == n / 3);
+            for (int i = 0; i < n; i++)
+                pass = pass && (c1.contains(points[i]) == (i < n / 3));
+
+            c1 -= c1;
+            pass = pass && (c1.getSize() == 0);
+
+            for (int i = 0; i < n; i++) c2.remove(points[i]);
+            for (int i = 0; i < n; i++) delete points[i];
+
+            ec.result(pass);
+        }
+    }
+}
+
 // Centroid
 void test_cluster_centroid(ErrorContext &ec, unsigned int numRuns) { // TODO implement
     bool pass;
@@ -1852,17 +2336,58 @@ void test_cluster_id(ErrorContext &ec, unsigned int numRuns) {
 
             ec.result(pass);
         }
-    }
-}
 
-// Init element selection ("pickPoints")
-void test_cluster_initselection(ErrorContext &ec, unsigned int numRuns) {
-    bool pass;
+        ec.DESC("unique id-s across threads");
 
-    // Run at least once!!
-    assert(numRuns > 0);
+        {
+            const int threads = 4, perThread = 1000;
+            std::vector<unsigned int> ids(threads * perThread);
+            std::vector<std::thread> workers;
 
-    ec.DESC("--- Test - Cluster - Select initial centroids ---");
+            for (int t = 0; t < threads; t++)
+                workers.emplace_back([&ids, t]() {
+                    for (int i = 0; i < perThread; i++)
+                        ids[t * perThread + i] = Cluster(2).getId();
+                });
+            for (int t = 0; t < threads; t++) workers[t].join();
+
+            std::sort(ids.begin(), ids.end());
+            pass = (std::adjacent_find(ids.begin(), ids.end()) == ids.end());
+
+            ec.result(pass);
+        }
+
+        ec.DESC("id spaces number their clusters independently");
+
+        {
+            Cluster::IdSpace space1, space2;
+            Cluster c1(10, space1), c2(10, space1), c3(10, space2);
+
+            pass = (c1.getId() == 1) && (c2.getId() == 2) && (c3.getId() == 1);
+
+            KMeans local(5, 3, "", DOUBLE_PRECISION, true);
+            for (int i = 0; i < 3; i++)
+                pass = pass && (local[i].getId() == static_cast<unsigned int>(i + 1));
+
+            // By default a KMeans draws from the process-wide sequence
+            KMeans global(5, 3, "");
+            Cluster after(5);
+            pass = pass && (global[1].getId() == global[0].getId() + 1) &&
+                   (global[2].getId() == global[1].getId() + 1) && (after.getId() == global[2].getId() + 1);
+
+            ec.result(pass);
+        }
+    }
+}
+
+// Init element selection ("pickPoints")
+void test_cluster_initselection(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - Cluster - Select initial centroids ---");
 
     for (int run = 0; run < numRuns; run++) {
 
@@ -1906,9 +2431,9 @@ void test_cluster_initselection(ErrorContext &ec, unsigned int numRuns) {
                 c.add(ptr);
             }
             PointPtr *pointArray = new PointPtr[k];
-            c.pickPoints(k, pointArray);
+            std::vector<std::unique_ptr<Point> > placeholders = c.pickPoints(k, pointArray);
 
-            pass = true;
+            pass = (placeholders.size() == k - k/2);
 
             // all Cluster points should be returned as centroids
             int i = 0;
@@ -1919,9 +2444,8 @@ void test_cluster_initselection(ErrorContext &ec, unsigned int numRuns) {
             Point inf(20);
             for (int j = 0; j < 20; j++) inf[j + 1] = std::numeric_limits<double>::max();
             for ( ; i < k; i++) {
-                pass = pass && (*pointArray[i] == inf);
-                // these need to be deallocated since these were allocated by pickPoints
-                delete pointArray[i];
+                pass = pass && (*pointArray[i] == inf) && (pointArray[i] == placeholders[i - k/2].get());
+                // no deallocation, placeholders owns these
             }
 
             // clean up
@@ -2428,222 +2952,1598 @@ void test_kmeans_score(ErrorContext &ec, unsigned int numRuns) {
     }
 }
 
-// K larger than number of points
-void test_kmeans_toofewpoints(ErrorContext &ec, unsigned int numRuns) {
+// Membership bitmaps over the loaded points
+void test_kmeans_membership(ErrorContext &ec, unsigned int numRuns) {
     bool pass;
 
     // Run at least once!!
     assert(numRuns > 0);
 
-    ec.DESC("--- Test - KMeans - Too few points ---");
+    ec.DESC("--- Test - KMeans - Membership index ---");
 
     for (int run = 0; run < numRuns; run++) {
 
-        ec.DESC("4 points with k=8");
+        ec.DESC("contains agrees with the cluster lists after run");
 
         {
-            KMeans kmeans(5, 8, "points4.csv");
+            KMeans kmeans(3, 4, "points2499.csv");
 
-            kmeans.run(); // The points should end up each in its own cluster
+            kmeans.enableMembershipIndex();
+            kmeans.run();
 
-            pass = (kmeans.getScore() == 0.0); // zero intra-cluster distance!
+            pass = kmeans[0].hasMembershipIndex();
 
-            std::ofstream csv1("points4_2.csv", std::ofstream::out);
-            csv1 << kmeans;
-            csv1.close();
+            unsigned int total = 0;
+            for (int i = 0; i < 4; i++) {
+                total += kmeans[i].getSize();
+                for (LNodePtr node = kmeans[i].getheadpointer(); node != nullptr; node = node->next)
+                    for (int j = 0; j < 4; j++)
+                        pass = pass && (kmeans[j].contains(node->p) == (i == j));
+            }
+            pass = pass && (total == 2499);
 
-            ClusterCounts cc("points4_2.csv");
-            pass = pass && cc.parse_and_analyze() &&
-                   (cc.get_num_clusters() == 4) &&
-                   (cc.get_num_points() == 4);
+            ec.result(pass);
+        }
+
+        ec.DESC("equality with indexed and unindexed points");
+
+        {
+            KMeans kmeans(3, 2, "points2499.csv");
+
+            kmeans.enableMembershipIndex();
+
+            Cluster copy(kmeans[0]);
+            pass = (copy == kmeans[0]) && !(kmeans[1] == kmeans[0]);
+
+            PointPtr extra = new Point(3);
+            copy.add(extra);
+            pass = pass && copy.contains(extra) && !kmeans[0].contains(extra) && !(copy == kmeans[0]);
+
+            copy.remove(extra);
+            pass = pass && !copy.contains(extra) && (copy == kmeans[0]);
+
+            delete extra;
 
             ec.result(pass);
         }
 
-        ec.DESC("2499 points, k=2520 - COMMENTED OUT");
-        pass = true;
-//        ec.DESC("2499 points, k=2520");
-//
-//        {
-//            KMeans kmeans(3, 2520, "points2499.csv");
-//
-//            kmeans.run();
-//
-//            pass = (kmeans.getScore() > 0.0);
-//
-//            std::ofstream csv1("points2499_2.csv", std::ofstream::out);
-//            csv1 << kmeans;
-//            csv1.close();
-//
-//            ClusterCounts cc("points2499_2.csv");
-//            bool parse_success;
-//            pass = pass && (parse_success = cc.parse_and_analyze()) &&
-//                   (cc.get_num_clusters() < 2520) &&    // this is the only meaningful test for the number of clusters
-//                                                        // the exact number will vary with implementation
-//                   (cc.get_num_points() == 2499);
-//
-//            ec.result(pass);
-//        }
-        ec.result(pass);
+        ec.DESC("a point listed twice stays a member until both are removed");
+
+        {
+            KMeans kmeans(3, 2, "points2499.csv");
+
+            kmeans.enableMembershipIndex();
+
+            Cluster copy(kmeans[0]);
+            PointPtr twice = copy.getheadpointer()->p;
+            copy.add(twice);
+            pass = copy.contains(twice) && !(copy == kmeans[0]);
+
+            copy.remove(twice);
+            pass = pass && copy.contains(twice) && (copy == kmeans[0]);
+
+            copy.remove(twice);
+            pass = pass && !copy.contains(twice);
+
+            ec.result(pass);
+        }
     }
 }
 
+// Single-precision compute mode
+void test_kmeans_precision(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
 
-// Check if scoring works with large points
-void test_kmeans_largepoints(ErrorContext &ec, unsigned int numRuns) {
+    ec.DESC("--- Test - KMeans - Precision ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("4 points, 4 clusters, single precision");
+
+        {
+            KMeans kmeans(5, 4, "points4.csv", SINGLE_PRECISION);
+
+            kmeans.run(); // The points should end up each in its own cluster
+
+            pass = (kmeans.getPrecision() == SINGLE_PRECISION) &&
+                   (kmeans.getScore() == 0.0);
+
+            for (int i = 0; i < 4; i++)
+                pass = pass && (kmeans[i].getSize() == 1);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("double precision reads the points in place, single keeps floats");
+
+        {
+            ThreadPool pool(2);
+            KMeans kd(3, 3, "points2499.csv"),
+                   ks(3, 3, "points2499.csv", SINGLE_PRECISION);
+            kd.setThreadPool(pool);
+            ks.setThreadPool(pool);
+
+            kd.run();
+            ks.run();
+
+            pass = !pool.isPinned() &&
+                   (kd.__store.getSize() == 0) &&
+                   (kd.__store.memoryFootprint() == 0) &&
+                   (kd.__rows.size() == 2499) &&
+                   (kd.__rows[42] == kd.__points[42]->data()) &&
+                   (ks.__store.getSize() == 2499) &&
+                   (ks.__store.memoryFootprint() == 2499 * 3 * sizeof(float));
+
+            ec.result(pass);
+        }
+    }
+}
+
+// Label array and lazily materialized clusters
+void test_kmeans_labels(ErrorContext &ec, unsigned int numRuns) {
     bool pass;
 
     // Run at least once!!
     assert(numRuns > 0);
 
-    ec.DESC("--- Test - KMeans - Large points ---");
+    ec.DESC("--- Test - KMeans - Labels ---");
 
     for (int run = 0; run < numRuns; run++) {
 
-        ec.DESC("4 large points, k=1");
+        ec.DESC("labels agree with the materialized clusters");
 
         {
-            KMeans kmeans(4, 1, "points4_large.csv");
+            KMeans kmeans(3, 3, "points2499.csv");
 
             kmeans.run();
 
-            pass = (kmeans.getScore() > 0.0); // non-empty cluster
+            const std::vector<int> &labels = kmeans.getLabels();
+            pass = (labels.size() == 2499);
 
-            std::ofstream csv1("points4_large_2.csv", std::ofstream::out);
-            csv1 << kmeans;
-            csv1.close();
+            unsigned int total = 0;
+            for (int i = 0; i < 3; i++) {
+                total += kmeans[i].getSize();
+                for (LNodePtr node = kmeans[i].getheadpointer(); node != nullptr; node = node->next)
+                    pass = pass && (kmeans.clusterOf(*node->p) == i) &&
+                           (kmeans.getLabels()[node->p->getIndex()] == i);
+            }
 
-            ClusterCounts cc("points4_large_2.csv");
-            bool parse_success;
-            pass = pass &&
-                   (parse_success = cc.parse_and_analyze()) &&
-                   (cc.get_num_clusters() == 1) &&
-                   (cc.get_num_points() == 4);
+            Point outsider(3);
+            pass = pass && (total == 2499) && (kmeans.clusterOf(outsider) == -1);
 
             ec.result(pass);
         }
 
-        ec.DESC("4 large points, k=2");
+        ec.DESC("edits through operator[] are picked up");
 
         {
-            KMeans kmeans(4, 2, "points4_large.csv");
+            KMeans kmeans(5, 2, "points4.csv");
+
+            PointPtr moved = kmeans[0].getheadpointer()->p;
+            kmeans[1].add(kmeans[0].remove(moved));
+
+            pass = (kmeans.clusterOf(*moved) == 1) &&
+                   (kmeans[0].getSize() == 3) && (kmeans[1].getSize() == 1);
+
+            ec.result(pass);
+        }
+    }
+}
+
+// Convergence criteria
+void test_kmeans_convergence(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - KMeans - Convergence ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("default runs to a fixed point");
+
+        {
+            KMeans kmeans(3, 3, "points2499.csv");
 
             kmeans.run();
 
-            pass = (kmeans.getScore() > 0.0); // non-empty cluster
+            const KMeans::RunStats &stats = kmeans.getRunStats()[0];
+            pass = (stats.iterations > 1) &&
+                   (stats.reassigned == 0 || stats.shift == 0.0) &&
+                   (stats.iterations <= kmeans.getConvergence().maxIterations) &&
+                   (kmeans.getScore() == stats.betacv) && (kmeans.getScore() > 0.0);
 
-            std::ofstream csv1("points4_large_2.csv", std::ofstream::out);
-            csv1 << kmeans;
-            csv1.close();
+            ec.result(pass);
+        }
 
-            ClusterCounts cc("points4_large_2.csv");
-            bool parse_success;
-            pass = pass &&
-                   (parse_success = cc.parse_and_analyze()) &&
-                   (cc.get_num_clusters() == 2) &&
-                   (cc.get_num_points() == 4);
+        ec.DESC("iteration cap and per-iteration scoring");
+
+        {
+            KMeans capped(3, 3, "points2499.csv"), scored(3, 3, "points2499.csv"),
+                   plain(3, 3, "points2499.csv");
+
+            KMeans::Convergence convergence;
+            convergence.maxIterations = 1;
+            capped.setConvergence(convergence);
+            capped.run();
+
+            convergence = KMeans::Convergence();
+            convergence.scoreEveryIteration = true;
+            scored.setConvergence(convergence);
+            scored.run();
+            plain.run();
+
+            pass = (capped.getRunStats()[0].iterations == 1) &&
+                   (scored.getScore() == plain.getScore()) &&
+                   (scored.getLabels() == plain.getLabels());
 
             ec.result(pass);
         }
 
-        ec.DESC("4 large points, k=3");
+        ec.DESC("loose inertia tolerance stops early");
 
         {
-            KMeans kmeans(4, 3, "points4_large.csv");
+            KMeans loose(3, 3, "points2499.csv"), exact(3, 3, "points2499.csv");
 
-            kmeans.run();
+            KMeans::Convergence convergence;
+            convergence.minInertiaChange = 1.0; // any decrease is small enough
+            loose.setConvergence(convergence);
+            loose.run();
+            exact.run();
 
-            pass = (kmeans.getScore() > 0.0); // non-empty cluster
+            pass = (loose.getRunStats()[0].iterations <= exact.getRunStats()[0].iterations) &&
+                   (loose.getRunStats()[0].iterations <= 2);
 
-            std::ofstream csv1("points4_large_2.csv", std::ofstream::out);
-            csv1 << kmeans;
-            csv1.close();
+            ec.result(pass);
+        }
+    }
+}
 
-            ClusterCounts cc("points4_large_2.csv");
-            bool parse_success;
-            pass = pass &&
-                   (parse_success = cc.parse_and_analyze()) &&
-                   (cc.get_num_clusters() ==3 ) &&
-                   (cc.get_num_points() == 4);
+// Time-budgeted run
+void test_kmeans_deadline(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - KMeans - Deadline ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("expired deadline returns the starting clustering");
+
+        {
+            KMeans kmeans(3, 3, "points2499.csv");
+
+            bool converged = kmeans.run(std::chrono::steady_clock::now());
+
+            pass = !converged && (kmeans.getRunStats()[0].iterations == 0) &&
+                   std::isnan(kmeans.getScore()) && (kmeans[0].getSize() == 2499);
 
             ec.result(pass);
         }
 
-        ec.DESC("4 large points, k=4");
+        ec.DESC("generous deadline matches an unbounded run");
 
         {
-            KMeans kmeans(4, 4, "points4_large.csv");
+            KMeans timed(3, 3, "points2499.csv"), plain(3, 3, "points2499.csv");
 
-            kmeans.run();
+            bool converged = timed.run(std::chrono::steady_clock::now() + std::chrono::minutes(10));
+            plain.run();
 
-            pass = (kmeans.getScore() > 0.0); // non-empty cluster
+            pass = converged && timed.getRunStats()[0].converged &&
+                   (timed.getLabels() == plain.getLabels()) &&
+                   (timed.getScore() == plain.getScore());
 
-            std::ofstream csv1("points4_large_2.csv", std::ofstream::out);
-            csv1 << kmeans;
-            csv1.close();
+            ec.result(pass);
+        }
 
-            ClusterCounts cc("points4_large_2.csv");
-            bool parse_success;
-            pass = pass &&
-                   (parse_success = cc.parse_and_analyze()) &&
-                   (cc.get_num_clusters() <= 4) && // TODO investigate why != 4
-                   (cc.get_num_points() == 4);
+        ec.DESC("deadline during the score abandons it");
+
+        {
+            // One cheap iteration, then a quadratic score over 40000 points
+            // that takes seconds on one thread
+            std::mt19937 generator(run);
+            std::uniform_real_distribution<double> coordinate(0, 100);
+            std::vector<Point> points(40000, Point(3));
+            std::vector<PointPtr> pointers;
+            for (unsigned int p = 0; p < points.size(); p++) {
+                for (int d = 1; d <= 3; d++)
+                    points[p].setValue(d, coordinate(generator));
+                pointers.push_back(&points[p]);
+            }
+
+            ThreadPool serial(1);
+            KMeans kmeans(3, 4, "");
+            kmeans.setThreadPool(serial);
+            KMeans::Convergence convergence;
+            convergence.maxIterations = 1;
+            kmeans.setConvergence(convergence);
+            kmeans[0].addAll(pointers);
+            for (int i = 0; i < 4; i++)
+                kmeans[i].setCentroid(points[i]);
+
+            auto start = std::chrono::steady_clock::now();
+            bool converged = kmeans.run(start + std::chrono::milliseconds(50));
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            const KMeans::RunStats &stats = kmeans.getRunStats()[0];
+            pass = !converged && stats.expired && (stats.iterations == 1) &&
+                   std::isnan(kmeans.getScore()) && (seconds < 0.5);
 
             ec.result(pass);
         }
     }
 }
 
-// Large k, less than number of points
-void test_kmeans_toomanyclusters(ErrorContext &ec, unsigned int numRuns) {
+// Asynchronous run with progress and cancellation
+void test_kmeans_async(ErrorContext &ec, unsigned int numRuns) {
     bool pass;
 
     // Run at least once!!
     assert(numRuns > 0);
 
-    ec.DESC("--- Test - KMeans - Too many clusters ---");
+    ec.DESC("--- Test - KMeans - Async ---");
 
     for (int run = 0; run < numRuns; run++) {
 
-        ec.DESC("2499 points, k=250 - COMMENTED OUT");
-        pass = true;
-//        ec.DESC("2499 points, k=250");
-//
-//        {
-//            KMeans kmeans(3, 250, "points2499.csv");
-//
-//            kmeans.run();
-//
-//            pass = (kmeans.getScore() > 0.0);
-//
-//            std::ofstream csv1("points2499_2.csv", std::ofstream::out);
-//            csv1 << kmeans;
-//            csv1.close();
-//
-//            ClusterCounts cc("points2499_2.csv");
-//            bool parse_success;
-//            pass = pass && (parse_success = cc.parse_and_analyze()) &&
-//                   (cc.get_num_clusters() <= 250) &&    // this is the only meaningful test for the number of clusters
-//                                                        // the exact number will vary with implementation and runs
-//                                                        // since K-means is non-deterministic, and floating-point
-//                                                        // arithmetic is non-commutative
-//                   (cc.get_num_points() == 2499);
-//
-//            ec.result(pass);
-//        }
-        ec.result(pass);
+        ec.DESC("progress is reported for every iteration");
 
-        ec.DESC("2499 points, k=520 - COMMENTED OUT");
-        pass = true;
-//        ec.DESC("2499 points, k=520");
-//
-//        {
-//            KMeans kmeans(3, 520, "points2499.csv");
-//
-//            kmeans.run();
-//
-//            pass = (kmeans.getScore() > 0.0);
-//
+        {
+            KMeans kmeans(3, 3, "points2499.csv"), plain(3, 3, "points2499.csv");
+            std::vector<KMeans::Progress> reports;
+
+            KMeans::AsyncRun handle = kmeans.runAsync([&reports](const KMeans::Progress &progress) {
+                reports.push_back(progress);
+            });
+            handle.wait();
+            plain.run();
+
+            const KMeans::RunStats &stats = handle.get();
+            pass = handle.ready() && stats.converged && !stats.cancelled &&
+                   (reports.size() == stats.iterations) &&
+                   (reports.back().iteration == stats.iterations) &&
+                   (kmeans.getLabels() == plain.getLabels());
+
+            for (unsigned int i = 1; pass && i < reports.size(); i++)
+                pass = (reports[i].inertia <= reports[i - 1].inertia);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("cancellation keeps the clustering so far");
+
+        {
+            KMeans kmeans(3, 3, "points2499.csv");
+            std::atomic<bool> iterated(false), cancelled(false);
+
+            // Hold the run after its first iteration until cancel() went out
+            KMeans::AsyncRun handle = kmeans.runAsync([&iterated, &cancelled](const KMeans::Progress &) {
+                iterated = true;
+                while (!cancelled) std::this_thread::yield();
+            });
+            while (!iterated) std::this_thread::yield();
+            handle.cancel();
+            cancelled = true;
+
+            const KMeans::RunStats &stats = handle.get();
+            pass = stats.cancelled && !stats.converged && (stats.iterations == 1);
+
+            unsigned int total = 0;
+            for (int i = 0; i < 3; i++)
+                total += kmeans[i].getSize();
+            pass = pass && (total == 2499) && (kmeans[1].getSize() > 0);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("cancellation after the last iteration stops the score");
+
+        {
+            std::mt19937 generator(run);
+            std::uniform_real_distribution<double> coordinate(0, 100);
+            std::vector<Point> points(40000, Point(3));
+            std::vector<PointPtr> pointers;
+            for (unsigned int p = 0; p < points.size(); p++) {
+                for (int d = 1; d <= 3; d++)
+                    points[p].setValue(d, coordinate(generator));
+                pointers.push_back(&points[p]);
+            }
+
+            ThreadPool serial(1);
+            KMeans kmeans(3, 4, "");
+            kmeans.setThreadPool(serial);
+            KMeans::Convergence convergence;
+            convergence.maxIterations = 1;
+            kmeans.setConvergence(convergence);
+            kmeans[0].addAll(pointers);
+            for (int i = 0; i < 4; i++)
+                kmeans[i].setCentroid(points[i]);
+
+            // The only iteration's report holds the run until cancel() went
+            // out, so it lands between the loop and the seconds-long score
+            std::atomic<bool> iterated(false), cancelled(false);
+            KMeans::AsyncRun handle = kmeans.runAsync([&iterated, &cancelled](const KMeans::Progress &) {
+                iterated = true;
+                while (!cancelled) std::this_thread::yield();
+            });
+            while (!iterated) std::this_thread::yield();
+            handle.cancel();
+            auto start = std::chrono::steady_clock::now();
+            cancelled = true;
+
+            const KMeans::RunStats &stats = handle.get();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            pass = stats.cancelled && stats.expired && (stats.iterations == 1) &&
+                   std::isnan(stats.betacv) && (seconds < 0.5);
+
+            ec.result(pass);
+        }
+    }
+}
+
+// Bit-identical results for any thread count
+void test_kmeans_reproducible(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - KMeans - Reproducible ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("compensated and tree sums");
+
+        {
+            CompensatedSum sum;
+            sum.add(1e16);
+            sum.add(1.0);
+            sum.add(-1e16);
+
+            double values[] = {1, 2, 3, 4, 5};
+            pass = (sum.value() == 1.0) &&
+                   (treeReduce(std::vector<double>(values, values + 5)) == 15.0) &&
+                   (treeReduce(std::vector<double>()) == 0.0);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("1, 2 and 5 threads give identical centroids and labels");
+
+        {
+            ThreadPool one(1), two(2), five(5);
+            KMeans k1(3, 4, "points2499.csv"), k2(3, 4, "points2499.csv"), k5(3, 4, "points2499.csv");
+
+            k1.setThreadPool(one);
+            k2.setThreadPool(two);
+            k5.setThreadPool(five);
+            k1.runRestarts(3, 5, 3);
+            k2.runRestarts(3, 5, 3);
+            k5.runRestarts(3, 5, 3);
+
+            pass = (k1.getLabels() == k2.getLabels()) && (k1.getLabels() == k5.getLabels()) &&
+                   (k1.getScore() == k2.getScore()) && (k1.getScore() == k5.getScore());
+
+            for (int i = 0; i < 4; i++)
+                for (int d = 0; d < 3; d++)
+                    pass = pass && (k1[i].getCentroid().data()[d] == k2[i].getCentroid().data()[d]) &&
+                           (k1[i].getCentroid().data()[d] == k5[i].getCentroid().data()[d]);
+
+            ec.result(pass);
+        }
+    }
+}
+
+// Concurrent seeded restarts
+void test_kmeans_restarts(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - KMeans - Restarts ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("best of 4 restarts on 2 threads");
+
+        {
+            KMeans kmeans(3, 3, "points2499.csv");
+
+            kmeans.runRestarts(4, 7, 2);
+
+            const std::vector<KMeans::RunStats> &stats = kmeans.getRunStats();
+            pass = (stats.size() == 4);
+
+            for (unsigned int r = 0; pass && r < stats.size(); r++)
+                pass = (stats[r].seed == 7 + r) && (stats[r].iterations > 0) &&
+                       (stats[kmeans.getBestRun()].betacv <= stats[r].betacv);
+
+            unsigned int total = 0;
+            for (int i = 0; i < 3; i++)
+                total += kmeans[i].getSize();
+            pass = pass && (total == 2499);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("same seed, same result");
+
+        {
+            KMeans kmeans1(3, 3, "points2499.csv"),
+                   kmeans2(3, 3, "points2499.csv");
+
+            kmeans1.runRestarts(3, 11, 1);
+            kmeans2.runRestarts(3, 11, 3);
+
+            pass = (kmeans1.getBestRun() == kmeans2.getBestRun()) &&
+                   (kmeans1.getLabels() == kmeans2.getLabels());
+
+            ec.result(pass);
+        }
+
+        ec.DESC("degenerate and unscored runs rank last");
+
+        {
+            KMeans::RunStats scored, oneCluster, singletons, unscored;
+            scored.betacv = 0.5;
+            scored.inertia = 100;
+            oneCluster.degenerate = true; // BetaCV comes back 0
+            oneCluster.inertia = 50;
+            singletons.degenerate = true;
+            singletons.inertia = 0;
+            unscored.betacv = std::numeric_limits<double>::quiet_NaN();
+            unscored.inertia = 0;
+
+            pass = KMeans::betterRun(scored, oneCluster) && !KMeans::betterRun(oneCluster, scored) &&
+                   KMeans::betterRun(singletons, oneCluster) && KMeans::betterRun(oneCluster, unscored) &&
+                   !KMeans::betterRun(unscored, scored);
+
+            // Every restart of 4 points in 4 clusters is all singletons
+            KMeans kmeans(5, 4, "points4.csv");
+            kmeans.runRestarts(3, 0, 1);
+            for (unsigned int r = 0; r < kmeans.getRunStats().size(); r++)
+                pass = pass && kmeans.getRunStats()[r].degenerate;
+
+            ec.result(pass);
+        }
+    }
+}
+
+// Parallel sweep over k
+void test_kmeans_sweep(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - KMeans - Sweep ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("warm-started sweep, inertia never grows");
+
+        {
+            KMeans kmeans(3, 2, "points2499.csv");
+
+            std::vector<KMeans::RunStats> curve = kmeans.sweep(1, 6, 3, 1);
+
+            pass = (curve.size() == 6);
+            for (unsigned int i = 0; pass && i < curve.size(); i++) {
+                pass = (curve[i].clusters == static_cast<int>(i + 1)) && (curve[i].iterations > 0);
+                if (i > 0)
+                    pass = pass && (curve[i].inertia <= curve[i - 1].inertia);
+            }
+
+            // The object's own clustering is left alone
+            pass = pass && (kmeans[0].getSize() + kmeans[1].getSize() == 2499);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("sweep split across threads");
+
+        {
+            KMeans kmeans(3, 2, "points2499.csv");
+
+            std::vector<KMeans::RunStats> curve = kmeans.sweep(2, 9, 3, 3);
+
+            pass = (curve.size() == 8);
+            for (unsigned int i = 0; pass && i < curve.size(); i++)
+                pass = (curve[i].clusters == static_cast<int>(i + 2)) && (curve[i].inertia > 0);
+
+            pass = pass && kmeans.sweep(3, 2).empty();
+
+            ec.result(pass);
+        }
+    }
+}
+
+// kd-tree filtering
+void test_kmeans_kdtree(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - KMeans - KdTree ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("filtering matches a brute-force assignment");
+
+        {
+            std::vector<Point> points;
+            std::vector<PointPtr> rows;
+            for (int i = 0; i < 500; i++) {
+                Point p(2);
+                p.setValue(1, (i * 37) % 101);
+                p.setValue(2, (i * 53) % 97);
+                points.push_back(p);
+            }
+            for (unsigned int i = 0; i < points.size(); i++)
+                rows.push_back(&points[i]);
+
+            KdTree tree(rows, 2);
+            double centroids[] = { 10, 10, 80, 20, 50, 50, 20, 90, 90, 90 };
+
+            std::vector<int> labels(rows.size(), 0);
+            std::vector<double> sums(10, 0.0);
+            std::vector<unsigned int> counts(5, 0);
+            unsigned int reassigned = 0;
+            double inertia = 0;
+            tree.filter(centroids, 5, labels, sums.data(), counts.data(), reassigned, inertia);
+
+            pass = (tree.getSize() == 500) && (tree.getNodes() > 1);
+
+            double expected = 0;
+            unsigned int total = 0;
+            for (unsigned int j = 0; pass && j < rows.size(); j++) {
+                int nearest = 0;
+                double best = std::numeric_limits<double>::max();
+                for (int c = 0; c < 5; c++) {
+                    double dx = rows[j]->getValue(1) - centroids[2 * c],
+                           dy = rows[j]->getValue(2) - centroids[2 * c + 1];
+                    if (dx * dx + dy * dy < best) {
+                        best = dx * dx + dy * dy;
+                        nearest = c;
+                    }
+                }
+                expected += best;
+                pass = (labels[j] == nearest);
+            }
+            for (int c = 0; c < 5; c++)
+                total += counts[c];
+
+            pass = pass && (total == 500) && (std::fabs(inertia - expected) < 1e-6 * expected);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("FILTERING gives Lloyd's clustering");
+
+        {
+            KMeans lloyd(3, 4, "points2499.csv"),
+                   filtering(3, 4, "points2499.csv");
+            filtering.setAlgorithm(KMeans::FILTERING);
+
+            lloyd.runRestarts(3, 5, 1);
+            filtering.runRestarts(3, 5, 2);
+
+            pass = (lloyd.getLabels() == filtering.getLabels()) &&
+                   (std::fabs(lloyd.getScore() - filtering.getScore()) < 1e-9);
+
+            for (unsigned int r = 0; pass && r < 3; r++)
+                pass = (lloyd.getRunStats()[r].iterations == filtering.getRunStats()[r].iterations);
+
+            ec.result(pass);
+        }
+    }
+}
+
+// Centroid index for large k
+void test_kmeans_indexed(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - KMeans - Centroid index ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("index matches a full scan from any start");
+
+        {
+            std::mt19937 generator(run);
+            std::uniform_real_distribution<double> coordinate(0, 100);
+
+            // More centroids than CentroidIndex keeps as neighbours
+            const unsigned int k = 300, dims = 3;
+            std::vector<double> centroids(k * dims);
+            for (unsigned int i = 0; i < centroids.size(); i++)
+                centroids[i] = coordinate(generator);
+
+            CentroidIndex index(dims);
+            index.rebuild(centroids.data(), k);
+
+            pass = (index.getClusters() == k);
+            for (int q = 0; pass && q < 500; q++) {
+                double row[dims] = { coordinate(generator), coordinate(generator), coordinate(generator) };
+
+                int nearest = 0;
+                double best = std::numeric_limits<double>::max();
+                for (unsigned int i = 0; i < k; i++) {
+                    double d = 0;
+                    for (unsigned int c = 0; c < dims; c++)
+                        d += (row[c] - centroids[i * dims + c]) * (row[c] - centroids[i * dims + c]);
+                    if (d < best) {
+                        best = d;
+                        nearest = i;
+                    }
+                }
+
+                double distance;
+                pass = (index.nearest(row, q % k, distance) == nearest) &&
+                       (std::fabs(distance - best) <= 1e-9 * best);
+            }
+
+            ec.result(pass);
+        }
+
+        ec.DESC("updated index matches a full scan and bounds the runner-up");
+
+        {
+            std::mt19937 generator(run);
+            std::uniform_real_distribution<double> coordinate(0, 100);
+
+            const unsigned int k = 300, dims = 3;
+            std::vector<double> centroids(k * dims);
+            for (unsigned int i = 0; i < centroids.size(); i++)
+                centroids[i] = coordinate(generator);
+
+            CentroidIndex index(dims);
+            index.rebuild(centroids.data(), k);
+
+            // Move a few centroids per round, some of them far
+            pass = true;
+            for (int round = 0; pass && round < 5; round++) {
+                std::vector<unsigned int> moved;
+                for (unsigned int i = round; i < k; i += 7) {
+                    for (unsigned int c = 0; c < dims; c++)
+                        centroids[i * dims + c] = coordinate(generator);
+                    moved.push_back(i);
+                }
+                index.update(moved);
+
+                for (int q = 0; pass && q < 200; q++) {
+                    double row[dims] = { coordinate(generator), coordinate(generator), coordinate(generator) };
+
+                    std::vector<double> distances(k);
+                    int nearest = 0;
+                    for (unsigned int i = 0; i < k; i++) {
+                        distances[i] = 0;
+                        for (unsigned int c = 0; c < dims; c++)
+                            distances[i] += (row[c] - centroids[i * dims + c]) * (row[c] - centroids[i * dims + c]);
+                        if (distances[i] < distances[nearest])
+                            nearest = i;
+                    }
+                    double runnerUp = std::numeric_limits<double>::max();
+                    for (unsigned int i = 0; i < k; i++)
+                        if (static_cast<int>(i) != nearest)
+                            runnerUp = std::min(runnerUp, std::sqrt(distances[i]));
+
+                    double distance, second;
+                    pass = (index.nearest(row, q % k, distance, &second) == nearest) &&
+                           (second <= runnerUp * (1 + 1e-12));
+                }
+            }
+
+            ec.result(pass);
+        }
+
+        ec.DESC("INDEXED gives Lloyd's clustering");
+
+        {
+            KMeans lloyd(3, 40, "points2499.csv"),
+                   indexed(3, 40, "points2499.csv");
+            indexed.setAlgorithm(KMeans::INDEXED);
+
+            lloyd.runRestarts(2, 9, 1);
+            indexed.runRestarts(2, 9, 2);
+
+            pass = (lloyd.getLabels() == indexed.getLabels()) &&
+                   (lloyd.getScore() == indexed.getScore());
+
+            ec.result(pass);
+        }
+
+        ec.DESC("predict finds the nearest centroid");
+
+        {
+            KMeans kmeans(3, 40, "points2499.csv");
+            kmeans.run();
+
+            pass = true;
+            for (int q = 0; pass && q < 50; q++) {
+                Point p(3);
+                for (int c = 1; c <= 3; c++)
+                    p.setValue(c, (q * 7 + c * 13) % 50);
+
+                int nearest = 0;
+                double best = std::numeric_limits<double>::max();
+                for (int i = 0; i < 40; i++) {
+                    double d = p.distanceTo(kmeans[i].getCentroid());
+                    if (d < best) {
+                        best = d;
+                        nearest = i;
+                    }
+                }
+
+                pass = (kmeans.predict(p) == nearest);
+            }
+
+            pass = pass && (kmeans.predict(Point(2)) == -1);
+
+            ec.result(pass);
+        }
+    }
+}
+
+// Product-quantized assignment
+void test_kmeans_quantized(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - KMeans - Quantized ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("table distance is the distance to the decoded point");
+
+        {
+            std::mt19937 generator(run);
+            std::uniform_real_distribution<double> coordinate(-10, 10);
+
+            std::vector<Point> points(300, Point(12));
+            std::vector<PointPtr> rows;
+            for (unsigned int i = 0; i < points.size(); i++) {
+                for (int d = 1; d <= 12; d++)
+                    points[i].setValue(d, coordinate(generator));
+                rows.push_back(&points[i]);
+            }
+
+            ProductQuantizer quantizer(rows, 12, 5, 32, run);
+            pass = (quantizer.getSubspaces() == 5) && (quantizer.getCodewords() == 32) &&
+                   (quantizer.getSize() == 300);
+
+            double centroid[12], decoded[12];
+            for (int d = 0; d < 12; d++)
+                centroid[d] = coordinate(generator);
+            std::vector<double> table(5 * 32);
+            quantizer.table(centroid, table.data());
+
+            for (unsigned int j = 0; pass && j < rows.size(); j++) {
+                quantizer.decode(quantizer.code(j), decoded);
+                double exact = 0;
+                for (int d = 0; d < 12; d++)
+                    exact += (centroid[d] - decoded[d]) * (centroid[d] - decoded[d]);
+                pass = std::fabs(quantizer.distance(quantizer.code(j), table.data()) - exact) <= 1e-9 * exact;
+            }
+
+            ec.result(pass);
+        }
+
+        ec.DESC("re-ranking every centroid is exact");
+
+        {
+            KMeans lloyd(3, 5, "points2499.csv"),
+                   quantized(3, 5, "points2499.csv");
+
+            KMeans::Quantization quantization;
+            quantization.subspaces = 2;
+            quantization.codewords = 16;
+            quantization.rerank = 5;
+            quantized.setQuantization(quantization);
+            quantized.setAlgorithm(KMeans::QUANTIZED);
+
+            lloyd.runRestarts(2, 3, 1);
+            quantized.runRestarts(2, 3, 2);
+
+            pass = (lloyd.getLabels() == quantized.getLabels()) &&
+                   (quantized.getRunStats()[0].recall == 1.0) &&
+                   (quantized.getRunStats()[1].recall == 1.0);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("128 dimensions, few candidates re-ranked");
+
+        {
+            std::mt19937 generator(run);
+            std::uniform_real_distribution<double> centre(0, 100);
+            std::normal_distribution<double> spread(0, 5);
+
+            std::vector<double> centres(8 * 128);
+            for (unsigned int i = 0; i < centres.size(); i++)
+                centres[i] = centre(generator);
+
+            {
+                std::ofstream csv("points128_pq.csv");
+                for (int p = 0; p < 400; p++) {
+                    for (int d = 0; d < 128; d++)
+                        csv << (d > 0 ? "," : "") << centres[(p % 8) * 128 + d] + spread(generator);
+                    csv << std::endl;
+                }
+            }
+
+            KMeans lloyd(128, 8, "points128_pq.csv"),
+                   quantized(128, 8, "points128_pq.csv");
+
+            KMeans::Quantization quantization;
+            quantization.subspaces = 16;
+            quantization.codewords = 64;
+            quantization.rerank = 2;
+            quantized.setQuantization(quantization);
+            quantized.setAlgorithm(KMeans::QUANTIZED);
+
+            lloyd.runRestarts(1, 5, 1);
+            quantized.runRestarts(1, 5, 1);
+
+            const KMeans::RunStats &exact = lloyd.getRunStats()[0],
+                                   &approximate = quantized.getRunStats()[0];
+            pass = (approximate.recall >= 0.9) && (exact.recall == 1.0) &&
+                   (approximate.inertia <= 1.05 * exact.inertia);
+
+            std::remove("points128_pq.csv");
+
+            ec.result(pass);
+        }
+    }
+}
+
+// Random-projection preprocessing
+void test_kmeans_projection(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - KMeans - Projection ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("sparse projection keeps pairwise distances");
+
+        {
+            std::mt19937 generator(run);
+            std::uniform_real_distribution<double> coordinate(-1, 1);
+
+            const unsigned int in = 400, out = 200, n = 60;
+            std::vector<double> points(n * in), projected(n * out);
+            for (unsigned int i = 0; i < points.size(); i++)
+                points[i] = coordinate(generator);
+
+            RandomProjection projection(in, out, run), again(in, out, run);
+            pass = (projection.getNonZeros() > 0) && (projection.getNonZeros() < in * out / 4) &&
+                   (projection.getNonZeros() == again.getNonZeros());
+
+            for (unsigned int j = 0; j < n; j++)
+                projection.project(&points[j * in], &projected[j * out]);
+
+            unsigned int pairs = 0, kept = 0;
+            for (unsigned int a = 0; a < n; a++)
+                for (unsigned int b = a + 1; b < n; b++) {
+                    double ratio = distanceSquared(&projected[a * out], &projected[b * out], out) /
+                                   distanceSquared(&points[a * in], &points[b * in], in);
+                    pairs++;
+                    if (ratio > 0.6 && ratio < 1.4)
+                        kept++;
+                }
+            pass = pass && (kept >= 0.95 * pairs);
+
+            pass = pass && (RandomProjection::targetDims(1000, 0.5) == 332);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("no-op when not reducing");
+
+        {
+            KMeans plain(3, 4, "points2499.csv"),
+                   projected(3, 4, "points2499.csv");
+            projected.setProjection(3);
+
+            plain.run();
+            projected.run();
+
+            pass = (plain.getLabels() == projected.getLabels()) &&
+                   (plain.getScore() == projected.getScore());
+
+            ec.result(pass);
+        }
+
+        ec.DESC("clusters 64 dimensions in 16, centroids in 64");
+
+        {
+            std::mt19937 generator(run);
+            std::uniform_real_distribution<double> centre(0, 100);
+            std::normal_distribution<double> spread(0, 3);
+
+            std::vector<double> centres(4 * 64);
+            for (unsigned int i = 0; i < centres.size(); i++)
+                centres[i] = centre(generator);
+
+            {
+                std::ofstream csv("points64_rp.csv");
+                for (int p = 0; p < 200; p++) {
+                    for (int d = 0; d < 64; d++)
+                        csv << (d > 0 ? "," : "") << centres[(p % 4) * 64 + d] + spread(generator);
+                    csv << std::endl;
+                }
+            }
+
+            KMeans plain(64, 4, "points64_rp.csv"),
+                   projected(64, 4, "points64_rp.csv");
+            projected.setProjection(16, run);
+
+            // Both start from the true centres, so both should find the blobs
+            for (int i = 0; i < 4; i++) {
+                Point c(64);
+                for (int d = 0; d < 64; d++)
+                    c.setValue(d + 1, centres[i * 64 + d]);
+                plain[i].setCentroid(c);
+                projected[i].setCentroid(c);
+            }
+
+            plain.run();
+            projected.run();
+
+            const KMeans::RunStats &exact = plain.getRunStats()[0],
+                                   &reduced = projected.getRunStats()[0];
+            pass = (reduced.iterations > 0) && (reduced.inertia <= 1.1 * exact.inertia) &&
+                   !std::isnan(projected.getScore());
+
+            // Every centroid is the mean of its points in the original space
+            const std::vector<int> labels = projected.getLabels();
+            for (int i = 0; pass && i < 4; i++) {
+                std::vector<double> mean(64, 0.0);
+                unsigned int count = 0;
+                for (unsigned int j = 0; j < labels.size(); j++)
+                    if (labels[j] == i) {
+                        addCoords(mean.data(), projected.__points[j]->data(), 64);
+                        count++;
+                    }
+                if (count == 0)
+                    continue;
+                divideCoords(mean.data(), count, 64);
+                pass = distanceSquared(mean.data(), projected[i].getCentroid().data(), 64) < 1e-12;
+            }
+
+            std::remove("points64_rp.csv");
+
+            ec.result(pass);
+        }
+    }
+}
+
+// Sparse points
+void test_kmeans_sparse(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - KMeans - Sparse ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("index:value rows and their distances");
+
+        {
+            SparseStore::Entries entries;
+            pass = SparseStore::parseRow("3:1.5 1:2,7:-1", 8, entries) &&
+                   (entries.size() == 3) &&
+                   (entries[0] == std::make_pair(0u, 2.0)) &&
+                   (entries[1] == std::make_pair(2u, 1.5)) &&
+                   (entries[2] == std::make_pair(6u, -1.0));
+
+            pass = pass && SparseStore::parseRow("+1 3:1.5 1:2", 8, entries) && (entries.size() == 2) &&
+                   (entries[0] == std::make_pair(0u, 2.0));
+
+            pass = pass && !SparseStore::parseRow("9:1", 8, entries) &&
+                   !SparseStore::parseRow("0:1", 8, entries) &&
+                   !SparseStore::parseRow("2 3", 8, entries) &&
+                   SparseStore::parseRow("", 8, entries) && entries.empty();
+
+            double a[8] = { 2, 0, 1.5, 0, 0, 0, -1, 0 },
+                   b[8] = { 0, 4, 1, 0, 0, 0, 0, 3 },
+                   c[8] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+            SparseStore store(8);
+            store.appendRow(a);
+            store.appendRow(b);
+
+            double cNorm = 8;
+            pass = pass && (store.getSize() == 2) && (store.getNonZeros() == 6) &&
+                   (std::fabs(store.distanceSquared(0, c, cNorm) - distanceSquared(a, c, 8)) < 1e-12) &&
+                   (std::fabs(store.distanceSquared(1, c, cNorm) - distanceSquared(b, c, 8)) < 1e-12) &&
+                   (std::fabs(store.distanceSquared(0, 1) - distanceSquared(a, b, 8)) < 1e-12);
+
+            double sum[8] = { 0 };
+            store.addTo(0, sum);
+            store.addTo(1, sum);
+            for (int d = 0; pass && d < 8; d++)
+                pass = (sum[d] == a[d] + b[d]);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("sparse file clustered with sparse kernels");
+
+        {
+            // 3 groups of 40 points in 200 dimensions, 5 nonzeros each, as
+            // LIBSVM rows led by the group and as the same points in a csv
+            std::vector<std::vector<double> > rows(120, std::vector<double>(200, 0.0));
+            {
+                std::ofstream file("points_sparse.txt"), csv("points_sparse.csv");
+                for (int p = 0; p < 120; p++) {
+                    int group = p % 3;
+                    file << group;
+                    for (int e = 0; e < 5; e++) {
+                        int index = group * 60 + (p * 7 + e * 11) % 50 + 1;
+                        file << " " << index << ":" << 1 + (p + e) % 4;
+                        rows[p][index - 1] = 1 + (p + e) % 4;
+                    }
+                    file << std::endl;
+                    for (int d = 0; d < 200; d++)
+                        csv << (d > 0 ? "," : "") << rows[p][d];
+                    csv << std::endl;
+                }
+            }
+
+            KMeans dense(200, 3, "points_sparse.csv"),
+                   denseSparse(200, 3, "points_sparse.csv"),
+                   sparse(200, 3, "points_sparse.txt");
+            denseSparse.setSparse(true);
+
+            // The sparse file makes no Points at all
+            pass = sparse.isSparse() && (sparse[0].getSize() == 0) && sparse.__points.empty() &&
+                   (sparse.getLabels().size() == 120) && (sparse.__sparse->getNonZeros() <= 5 * 120) &&
+                   (dense[0].getSize() == 120);
+
+            // Same start everywhere: the first point of each group
+            for (int i = 0; i < 3; i++) {
+                Point start(200);
+                for (int d = 0; d < 200; d++)
+                    start.data()[d] = rows[i][d];
+                dense[i].setCentroid(start);
+                denseSparse[i].setCentroid(start);
+                sparse[i].setCentroid(start);
+            }
+
+            dense.run();
+            denseSparse.run();
+            sparse.run();
+
+            // The csv rows come back sorted, so compare what does not
+            // depend on the row order
+            std::vector<unsigned int> sizes(3);
+            for (unsigned int j = 0; j < sparse.getLabels().size(); j++)
+                sizes[sparse.getLabels()[j]]++;
+
+            pass = pass && (dense.getLabels() == denseSparse.getLabels()) &&
+                   (std::fabs(dense.getScore() - denseSparse.getScore()) < 1e-9 * dense.getScore()) &&
+                   (std::fabs(dense.getScore() - sparse.getScore()) < 1e-9 * dense.getScore()) &&
+                   (std::fabs(dense.getRunStats()[0].inertia - sparse.getRunStats()[0].inertia) <
+                    1e-9 * dense.getRunStats()[0].inertia);
+            for (int i = 0; i < 3; i++)
+                pass = pass && (dense[i].getSize() == sizes[i]);
+
+            std::remove("points_sparse.csv");
+            std::remove("points_sparse.txt");
+
+            ec.result(pass);
+        }
+    }
+}
+
+// Distance metric policies
+void test_kmeans_metric(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - KMeans - Metrics ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("every policy, fixed and generic dimensions");
+
+        {
+            double a[5] = { 1, -2, 3, 0.5, 4 },
+                   b[5] = { 2, 2, 1, 0.5, 1 };
+
+            // 3 dimensions use FixedPoint<3>, 5 the generic loop
+            pass = true;
+            unsigned int dims[2] = { 3, 5 };
+            for (int t = 0; pass && t < 2; t++) {
+                unsigned int n = dims[t];
+                double squared = 0, manhattan = 0, chebyshev = 0, dot = 0;
+                for (unsigned int i = 0; i < n; i++) {
+                    squared += (a[i] - b[i]) * (a[i] - b[i]);
+                    manhattan += std::fabs(a[i] - b[i]);
+                    chebyshev = std::max(chebyshev, std::fabs(a[i] - b[i]));
+                    dot += a[i] * b[i];
+                }
+
+                pass = (selectDistanceKernel<double>(n, EUCLIDEAN)(a, b, n) == squared) &&
+                       (selectDistanceKernel<double>(n, SQUARED_EUCLIDEAN)(a, b, n) == squared) &&
+                       (selectDistanceKernel<double>(n, MANHATTAN)(a, b, n) == manhattan) &&
+                       (selectDistanceKernel<double>(n, CHEBYSHEV)(a, b, n) == chebyshev) &&
+                       (selectDistanceKernel<double>(n, COSINE)(a, b, n) == 1 - dot) &&
+                       (selectMetricKernel<Manhattan, float>(n) != nullptr) &&
+                       (metricDistance(EUCLIDEAN, squared) == std::sqrt(squared)) &&
+                       (metricDistance(MANHATTAN, manhattan) == manhattan);
+            }
+
+            // The inlined dispatch used by Point and the loops of a run
+            for (unsigned int n = 2; pass && n <= 5; n++)
+                pass = (metricKernel<Manhattan>(a, b, n) == selectMetricKernel<Manhattan>(n)(a, b, n)) &&
+                       (metricKernel<Chebyshev>(a, b, n) == selectMetricKernel<Chebyshev>(n)(a, b, n)) &&
+                       (metricKernel<Cosine>(a, b, n) == selectMetricKernel<Cosine>(n)(a, b, n));
+
+            Point p1(3), p2(3);
+            p1.setValue(1, 1); p1.setValue(2, 2); p1.setValue(3, 3);
+            p2.setValue(1, 4); p2.setValue(2, 6); p2.setValue(3, 3);
+            pass = pass && (p1.distanceTo<Euclidean>(p2) == 5) && (p1.distanceTo(p2) == 5) &&
+                   (p1.distanceTo<SquaredEuclidean>(p2) == 25) &&
+                   (p1.distanceTo<Manhattan>(p2) == 7) && (p1.distanceTo<Chebyshev>(p2) == 4);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("EUCLIDEAN is the default clustering");
+
+        {
+            KMeans plain(3, 4, "points2499.csv"),
+                   metric(3, 4, "points2499.csv");
+            metric.setMetric(EUCLIDEAN);
+
+            plain.run();
+            metric.run();
+
+            pass = (plain.getLabels() == metric.getLabels()) && (plain.getScore() == metric.getScore());
+
+            ec.result(pass);
+        }
+
+        ec.DESC("Manhattan assignment and prediction");
+
+        {
+            KMeans kmeans(3, 4, "points2499.csv");
+            kmeans.setMetric(MANHATTAN);
+            kmeans.setAlgorithm(KMeans::INDEXED); // falls back to LLOYD
+
+            kmeans.run();
+
+            pass = (kmeans.getRunStats()[0].iterations > 0) && (kmeans.getScore() > 0);
+
+            for (int q = 0; pass && q < 40; q++) {
+                Point p(3);
+                for (int c = 1; c <= 3; c++)
+                    p.setValue(c, (q * 11 + c * 17) % 60);
+
+                int nearest = 0;
+                double best = std::numeric_limits<double>::max();
+                for (int i = 0; i < 4; i++) {
+                    double d = p.distanceTo<Manhattan>(kmeans[i].getCentroid());
+                    if (d < best) {
+                        best = d;
+                        nearest = i;
+                    }
+                }
+                pass = (kmeans.predict(p) == nearest);
+            }
+
+            ec.result(pass);
+        }
+
+        ec.DESC("cosine keeps unit-length centroids");
+
+        {
+            std::mt19937 generator(run);
+            std::normal_distribution<double> coordinate(0, 1);
+            {
+                std::ofstream csv("points_cosine.csv");
+                for (int p = 0; p < 90; p++) {
+                    double v[4], norm = 0;
+                    for (int d = 0; d < 4; d++) {
+                        v[d] = coordinate(generator) + ((p % 3 == d) ? 4 : 0);
+                        norm += v[d] * v[d];
+                    }
+                    for (int d = 0; d < 4; d++)
+                        csv << (d > 0 ? "," : "") << std::setprecision(17) << v[d] / std::sqrt(norm);
+                    csv << std::endl;
+                }
+            }
+
+            KMeans kmeans(4, 3, "points_cosine.csv");
+            kmeans.setMetric(COSINE);
+            kmeans.run();
+
+            pass = (kmeans.getRunStats()[0].iterations > 0);
+            for (int i = 0; pass && i < 3; i++) {
+                if (kmeans[i].getSize() == 0)
+                    continue;
+                const double *c = kmeans[i].getCentroid().data();
+                double norm = c[0] * c[0] + c[1] * c[1] + c[2] * c[2] + c[3] * c[3];
+                pass = std::fabs(norm - 1) < 1e-9;
+            }
+
+            std::remove("points_cosine.csv");
+
+            ec.result(pass);
+        }
+
+        ec.DESC("cosine skips centroids of unseeded clusters");
+
+        {
+            {
+                std::ofstream csv("points_cosine3.csv");
+                csv << "1,0,0" << std::endl << "0,1,0" << std::endl << "0,0,1" << std::endl;
+            }
+
+            KMeans kmeans(3, 5, "points_cosine3.csv");
+            kmeans.setMetric(COSINE);
+            kmeans.run();
+
+            // Only three clusters can be seeded; the others keep placeholder
+            // centroids that must never attract a point
+            const std::vector<int> &labels = kmeans.getLabels();
+            pass = (labels.size() == 3);
+            for (unsigned int i = 0; pass && i < labels.size(); i++)
+                pass = (labels[i] >= 0 && labels[i] < 3);
+            pass = pass && labels[0] != labels[1] && labels[1] != labels[2] && labels[0] != labels[2];
+
+            KMeans restarted(3, 5, "points_cosine3.csv");
+            restarted.setMetric(COSINE);
+            restarted.runRestarts(3, 1);
+            const std::vector<int> &restartLabels = restarted.getLabels();
+            for (unsigned int i = 0; pass && i < restartLabels.size(); i++)
+                pass = (restartLabels[i] >= 0 && restartLabels[i] < 3);
+
+            std::remove("points_cosine3.csv");
+
+            ec.result(pass);
+        }
+    }
+}
+
+// K larger than number of points
+void test_kmeans_toofewpoints(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - KMeans - Too few points ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("4 points with k=8");
+
+        {
+            KMeans kmeans(5, 8, "points4.csv");
+
+            kmeans.run(); // The points should end up each in its own cluster
+
+            pass = (kmeans.getScore() == 0.0); // zero intra-cluster distance!
+
+            std::ofstream csv1("points4_2.csv", std::ofstream::out);
+            csv1 << kmeans;
+            csv1.close();
+
+            ClusterCounts cc("points4_2.csv");
+            pass = pass && cc.parse_and_analyze() &&
+                   (cc.get_num_clusters() == 4) &&
+                   (cc.get_num_points() == 4);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("2499 points, k=2520 - COMMENTED OUT");
+        pass = true;
+//        ec.DESC("2499 points, k=2520");
+//
+//        {
+//            KMeans kmeans(3, 2520, "points2499.csv");
+//
+//            kmeans.run();
+//
+//            pass = (kmeans.getScore() > 0.0);
+//
+//            std::ofstream csv1("points2499_2.csv", std::ofstream::out);
+//            csv1 << kmeans;
+//            csv1.close();
+//
+//            ClusterCounts cc("points2499_2.csv");
+//            bool parse_success;
+//            pass = pass && (parse_success = cc.parse_and_analyze()) &&
+//                   (cc.get_num_clusters() < 2520) &&    // this is the only meaningful test for the number of clusters
+//                                                        // the exact number will vary with implementation
+//                   (cc.get_num_points() == 2499);
+//
+//            ec.result(pass);
+//        }
+        ec.result(pass);
+    }
+}
+
+
+// Check if scoring works with large points
+void test_kmeans_largepoints(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - KMeans - Large points ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("4 large points, k=1");
+
+        {
+            KMeans kmeans(4, 1, "points4_large.csv");
+
+            kmeans.run();
+
+            pass = (kmeans.getScore() > 0.0); // non-empty cluster
+
+            std::ofstream csv1("points4_large_2.csv", std::ofstream::out);
+            csv1 << kmeans;
+            csv1.close();
+
+            ClusterCounts cc("points4_large_2.csv");
+            bool parse_success;
+            pass = pass &&
+                   (parse_success = cc.parse_and_analyze()) &&
+                   (cc.get_num_clusters() == 1) &&
+                   (cc.get_num_points() == 4);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("4 large points, k=2");
+
+        {
+            KMeans kmeans(4, 2, "points4_large.csv");
+
+            kmeans.run();
+
+            pass = (kmeans.getScore() > 0.0); // non-empty cluster
+
+            std::ofstream csv1("points4_large_2.csv", std::ofstream::out);
+            csv1 << kmeans;
+            csv1.close();
+
+            ClusterCounts cc("points4_large_2.csv");
+            bool parse_success;
+            pass = pass &&
+                   (parse_success = cc.parse_and_analyze()) &&
+                   (cc.get_num_clusters() == 2) &&
+                   (cc.get_num_points() == 4);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("4 large points, k=3");
+
+        {
+            KMeans kmeans(4, 3, "points4_large.csv");
+
+            kmeans.run();
+
+            pass = (kmeans.getScore() > 0.0); // non-empty cluster
+
+            std::ofstream csv1("points4_large_2.csv", std::ofstream::out);
+            csv1 << kmeans;
+            csv1.close();
+
+            ClusterCounts cc("points4_large_2.csv");
+            bool parse_success;
+            pass = pass &&
+                   (parse_success = cc.parse_and_analyze()) &&
+                   (cc.get_num_clusters() ==3 ) &&
+                   (cc.get_num_points() == 4);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("4 large points, k=4");
+
+        {
+            KMeans kmeans(4, 4, "points4_large.csv");
+
+            kmeans.run();
+
+            pass = (kmeans.getScore() > 0.0); // non-empty cluster
+
+            std::ofstream csv1("points4_large_2.csv", std::ofstream::out);
+            csv1 << kmeans;
+            csv1.close();
+
+            ClusterCounts cc("points4_large_2.csv");
+            bool parse_success;
+            pass = pass &&
+                   (parse_success = cc.parse_and_analyze()) &&
+                   (cc.get_num_clusters() <= 4) && // TODO investigate why != 4
+                   (cc.get_num_points() == 4);
+
+            ec.result(pass);
+        }
+    }
+}
+
+// Large k, less than number of points
+void test_kmeans_toomanyclusters(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - KMeans - Too many clusters ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("2499 points, k=250 - COMMENTED OUT");
+        pass = true;
+//        ec.DESC("2499 points, k=250");
+//
+//        {
+//            KMeans kmeans(3, 250, "points2499.csv");
+//
+//            kmeans.run();
+//
+//            pass = (kmeans.getScore() > 0.0);
+//
+//            std::ofstream csv1("points2499_2.csv", std::ofstream::out);
+//            csv1 << kmeans;
+//            csv1.close();
+//
+//            ClusterCounts cc("points2499_2.csv");
+//            bool parse_success;
+//            pass = pass && (parse_success = cc.parse_and_analyze()) &&
+//                   (cc.get_num_clusters() <= 250) &&    // this is the only meaningful test for the number of clusters
+//                                                        // the exact number will vary with implementation and runs
+//                                                        // since K-means is non-deterministic, and floating-point
+//                                                        // arithmetic is non-commutative
+//                   (cc.get_num_points() == 2499);
+//
+//            ec.result(pass);
+//        }
+        ec.result(pass);
+
+        ec.DESC("2499 points, k=520 - COMMENTED OUT");
+        pass = true;
+//        ec.DESC("2499 points, k=520");
+//
+//        {
+//            KMeans kmeans(3, 520, "points2499.csv");
+//
+//            kmeans.run();
+//
+//            pass = (kmeans.getScore() > 0.0);
+//
 //            std::ofstream csv1("points2499_2.csv", std::ofstream::out);
 //            csv1 << kmeans;
 //            csv1.close();
@@ -2661,4 +4561,218 @@ void test_kmeans_toomanyclusters(ErrorContext &ec, unsigned int numRuns) {
 //        }
         ec.result(pass);
     }
-}
\ No newline at end of file
+}
+
+
+// - - - - - - - - - - T H R E A D   P O O L - - - - - - - - - -
+
+// Work-stealing pool: chunking, nesting, weighted bounds
+void test_threadpool(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - ThreadPool ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("every element visited once");
+
+        {
+            ThreadPool pool(4);
+            std::vector<int> visits(10000, 0);
+
+            pool.parallelFor(0, visits.size(), 7, [&visits](unsigned int, unsigned int first, unsigned int last) {
+                for (unsigned int i = first; i < last; i++) visits[i]++;
+            });
+
+            pass = (pool.getThreads() == 4) &&
+                   (std::count(visits.begin(), visits.end(), 1) == 10000);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("nested loops and a pinned single thread");
+
+        {
+            ThreadPool pool(3), pinned(2, std::vector<int>(1, 0)), inline_(1);
+            std::atomic<unsigned int> total(0);
+
+            pool.parallelFor(0, 16, 1, [&pool, &total](unsigned int, unsigned int, unsigned int) {
+                pool.parallelFor(0, 100, 10, [&total](unsigned int, unsigned int first, unsigned int last) {
+                    total += last - first;
+                });
+            });
+            pinned.parallelFor(0, 100, 3, [&total](unsigned int, unsigned int first, unsigned int last) {
+                total += last - first;
+            });
+            inline_.parallelFor(0, 100, 3, [&total](unsigned int, unsigned int first, unsigned int last) {
+                total += last - first;
+            });
+
+            pass = (total == 1800);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("a caller waiting on a running chunk sleeps");
+
+        {
+            ThreadPool pool(2);
+
+            // Whoever takes the slow chunk sleeps in it; the other thread
+            // has nothing left to run and must not spin meanwhile
+            std::clock_t cpu = std::clock();
+            auto start = std::chrono::steady_clock::now();
+            pool.parallelFor(0, 2, 1, [](unsigned int chunk, unsigned int, unsigned int) {
+                if (chunk == 1)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            });
+            double cpuSeconds = double(std::clock() - cpu) / CLOCKS_PER_SEC;
+            double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            pass = (wall >= 0.3) && (cpuSeconds < 0.1);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("weighted bounds balance skewed work");
+
+        {
+            // One heavy element then many light ones
+            std::vector<double> weights(101, 1.0);
+            weights[0] = 100;
+
+            std::vector<unsigned int> bounds = ThreadPool::weightedBounds(weights, 2);
+
+            pass = (bounds.size() == 3) && (bounds[0] == 0) && (bounds[1] == 1) && (bounds[2] == 101);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("replacing the shared pool under an existing KMeans");
+
+        {
+            KMeans before(3, 4, "points2499.csv"),
+                   reference(3, 4, "points2499.csv");
+
+            // before was built on the old shared pool, which is released here
+            ThreadPool::configureShared(3);
+            std::shared_ptr<ThreadPool> held = ThreadPool::shared();
+            before.run();
+            reference.run();
+
+            pass = (held->getThreads() == 3) && (before.getLabels() == reference.getLabels());
+
+            // Back to one thread per core
+            ThreadPool::configureShared(0);
+            pass = pass && (held->getThreads() == 3) && (ThreadPool::shared() != held);
+
+            ec.result(pass);
+        }
+    }
+}
+
+// NUMA topology and node-placed runs
+void test_threadpool_numa(ErrorContext &ec, unsigned int numRuns) {
+    bool pass;
+
+    // Run at least once!!
+    assert(numRuns > 0);
+
+    ec.DESC("--- Test - ThreadPool - NUMA ---");
+
+    for (int run = 0; run < numRuns; run++) {
+
+        ec.DESC("cpulist parsing");
+
+        {
+            std::vector<int> cpus = NumaTopology::parseCpuList("0-3,8,10-11\n");
+            int expected[] = {0, 1, 2, 3, 8, 10, 11};
+
+            pass = (cpus == std::vector<int>(expected, expected + 7)) &&
+                   NumaTopology::parseCpuList("").empty();
+
+            ec.result(pass);
+        }
+
+        ec.DESC("every cpu on exactly one node");
+
+        {
+            NumaTopology topology = NumaTopology::detect(),
+                         missing = NumaTopology::detect("/nonexistent");
+
+            std::vector<int> cpus = topology.cpusInNodeOrder();
+            std::vector<int> sorted(cpus);
+            std::sort(sorted.begin(), sorted.end());
+
+            pass = (topology.getNodes() >= 1) && !cpus.empty() &&
+                   (std::adjacent_find(sorted.begin(), sorted.end()) == sorted.end()) &&
+                   (missing.getNodes() == 1) && !missing.getCpus(0).empty();
+
+            ec.result(pass);
+        }
+
+        ec.DESC("pinned, node-placed pool gives the same clustering");
+
+        {
+            ThreadPool pinned(4, NumaTopology::detect().cpusInNodeOrder());
+            KMeans placed(3, 3, "points2499.csv"), plain(3, 3, "points2499.csv");
+
+            placed.setThreadPool(pinned);
+            pass = !placed.__storePlaced; // written by `pinned` at the first run
+            placed.run();
+            plain.run();
+
+            pass = pass && placed.__storePlaced && (placed.__store.getSize() == 2499) &&
+                   (placed.getLabels() == plain.getLabels()) &&
+                   (placed.getScore() == plain.getScore());
+
+            ec.result(pass);
+        }
+
+        ec.DESC("every pass of a placed run reads the placed rows");
+
+        {
+            ThreadPool pinned(4, NumaTopology::detect().cpusInNodeOrder());
+            KMeans placed(3, 5, "points2499.csv"), plain(3, 5, "points2499.csv");
+            placed.setAlgorithm(KMeans::INDEXED);
+            plain.setAlgorithm(KMeans::INDEXED);
+
+            placed.setThreadPool(pinned);
+            placed.run();
+            plain.run();
+
+            std::vector<double> buffer;
+            pass = (placed.rowData(7, buffer) == placed.__store.doubleRow(7)) &&
+                   (placed.rowData(7, buffer) != placed.__points[7]->data()) &&
+                   (plain.rowData(7, buffer) == plain.__points[7]->data()) &&
+                   (placed.getLabels() == plain.getLabels()) &&
+                   (placed.getScore() == plain.getScore()) &&
+                   (placed.getRunStats()[0].inertia == plain.getRunStats()[0].inertia);
+
+            ec.result(pass);
+        }
+
+        ec.DESC("workers spread over the nodes in proportion");
+
+        {
+            // Two nodes of 8 CPUs, node by node
+            std::vector<int> cpus;
+            for (int cpu = 0; cpu < 16; cpu++)
+                cpus.push_back(cpu);
+
+            int spread[4], wrapped[3];
+            for (unsigned int w = 0; w < 4; w++)
+                spread[w] = ThreadPool::workerCpu(cpus, w, 4);
+            for (unsigned int w = 0; w < 3; w++)
+                wrapped[w] = ThreadPool::workerCpu(std::vector<int>(cpus.begin(), cpus.begin() + 2), w, 3);
+
+            pass = (spread[0] == 0) && (spread[1] == 4) && (spread[2] == 8) && (spread[3] == 12) &&
+                   (wrapped[0] == 0) && (wrapped[1] == 1) && (wrapped[2] == 0);
+
+            ec.result(pass);
+        }
+    }
+}
@@ -31,15 +31,27 @@ void test_point_equality(ErrorContext &ec, unsigned int numRuns);
 // (pseudo-lexicographic comparison)
 void test_point_comparison(ErrorContext &ec, unsigned int numRuns);
 
+// compare, lexicographicOrder, Cluster::addAll
+void test_point_sort(ErrorContext &ec, unsigned int numRuns);
+
 // operator+=, operator-=, operator*=, operator/=
 void test_point_CAO(ErrorContext &ec, unsigned int numRuns);
 
 // operator+, operator-, operator*, operator/
 void test_point_SAO(ErrorContext &ec, unsigned int numRuns);
 
+// Move constructor, move assignment, in-place arithmetic
+void test_point_move(ErrorContext &ec, unsigned int numRuns);
+
+// Inline (small-buffer) coordinate storage
+void test_point_inline(ErrorContext &ec, unsigned int numRuns);
+
 // distanceTo
 void test_point_distance(ErrorContext &ec, unsigned int numRuns);
 
+// FixedPoint<D> kernels, dispatch by dimension
+void test_point_fixeddims(ErrorContext &ec, unsigned int numRuns);
+
 // operator>>, operator<< (incl. exceptions)
 void test_point_IO(ErrorContext &ec, unsigned int numRuns);
 
@@ -59,6 +71,12 @@ void test_cluster_move(ErrorContext &ec, unsigned int numRuns);
 // Copy constructor
 void test_cluster_copying(ErrorContext &ec, unsigned int numRuns);
 
+// Inner class MoveBatch
+void test_cluster_movebatch(ErrorContext &ec, unsigned int numRuns);
+
+// Copy-on-write snapshots
+void test_cluster_snapshot(ErrorContext &ec, unsigned int numRuns);
+
 // operator=
 void test_cluster_assignment(ErrorContext &ec, unsigned int numRuns);
 
@@ -71,6 +89,9 @@ void test_cluster_CAO(ErrorContext &ec, unsigned int numRuns);
 // operator+, operator-, different rhs
 void test_cluster_SAO(ErrorContext &ec, unsigned int numRuns);
 
+// operator+=, operator-= on large clusters
+void test_cluster_setops(ErrorContext &ec, unsigned int numRuns);
+
 // Centroid
 void test_cluster_centroid(ErrorContext &ec, unsigned int numRuns);
 
@@ -99,6 +120,51 @@ void test_kmeans_IO(ErrorContext &ec, unsigned int numRuns);
 // Clustering score
 void test_kmeans_score(ErrorContext &ec, unsigned int numRuns);
 
+// Membership bitmaps over the loaded points
+void test_kmeans_membership(ErrorContext &ec, unsigned int numRuns);
+
+// Single-precision compute mode
+void test_kmeans_precision(ErrorContext &ec, unsigned int numRuns);
+
+// Label array and lazily materialized clusters
+void test_kmeans_labels(ErrorContext &ec, unsigned int numRuns);
+
+// Convergence criteria
+void test_kmeans_convergence(ErrorContext &ec, unsigned int numRuns);
+
+// Time-budgeted run
+void test_kmeans_deadline(ErrorContext &ec, unsigned int numRuns);
+
+// Asynchronous run with progress and cancellation
+void test_kmeans_async(ErrorContext &ec, unsigned int numRuns);
+
+// Bit-identical results for any thread count
+void test_kmeans_reproducible(ErrorContext &ec, unsigned int numRuns);
+
+// Concurrent seeded restarts
+void test_kmeans_restarts(ErrorContext &ec, unsigned int numRuns);
+
+// Parallel sweep over k
+void test_kmeans_sweep(ErrorContext &ec, unsigned int numRuns);
+
+// kd-tree filtering
+void test_kmeans_kdtree(ErrorContext &ec, unsigned int numRuns);
+
+// Centroid index for large k
+void test_kmeans_indexed(ErrorContext &ec, unsigned int numRuns);
+
+// Product-quantized assignment
+void test_kmeans_quantized(ErrorContext &ec, unsigned int numRuns);
+
+// Random-projection preprocessing
+void test_kmeans_projection(ErrorContext &ec, unsigned int numRuns);
+
+// Sparse points
+void test_kmeans_sparse(ErrorContext &ec, unsigned int numRuns);
+
+// Distance metric policies
+void test_kmeans_metric(ErrorContext &ec, unsigned int numRuns);
+
 // K larger than number of points
 void test_kmeans_toofewpoints(ErrorContext &ec, unsigned int numRuns);
 
@@ -108,4 +174,13 @@ void test_kmeans_largepoints(ErrorContext &ec, unsigned int numRuns);
 // Large k, less than number of points
 void test_kmeans_toomanyclusters(ErrorContext &ec, unsigned int numRuns); // TODO implement
 
+
+// - - - - - - - - - Tests: class ThreadPool - - - - - - - - - -
+
+// Work-stealing pool: chunking, nesting, weighted bounds
+void test_threadpool(ErrorContext &ec, unsigned int numRuns);
+
+// NUMA topology and node-placed runs
+void test_threadpool_numa(ErrorContext &ec, unsigned int numRuns);
+
 #endif //CLUSTERING_CLUSTERINGTESTS_H
@@ -0,0 +1,204 @@
+#include "FixedPoint.h"
+
+using namespace Clustering;
+
+namespace Clustering {
+
+    template <typename Policy, typename T>
+    DistanceKernelT<T> selectMetricKernel(unsigned int dims)
+    {
+        switch (dims)
+        {
+            case 2: return MetricKernel<Policy, T, 2>::distance;
+            case 3: return MetricKernel<Policy, T, 3>::distance;
+            case 4: return MetricKernel<Policy, T, 4>::distance;
+            case 8: return MetricKernel<Policy, T, 8>::distance;
+            case 16: return MetricKernel<Policy, T, 16>::distance;
+            case 32: return MetricKernel<Policy, T, 32>::distance;
+            case 64: return MetricKernel<Policy, T, 64>::distance;
+            default: return MetricKernel<Policy, T, 0>::distance;
+        }
+    }
+
+    template DistanceKernelT<double> selectMetricKernel<SquaredEuclidean, double>(unsigned int);
+    template DistanceKernelT<float> selectMetricKernel<SquaredEuclidean, float>(unsigned int);
+    template DistanceKernelT<double> selectMetricKernel<Euclidean, double>(unsigned int);
+    template DistanceKernelT<float> selectMetricKernel<Euclidean, float>(unsigned int);
+    template DistanceKernelT<double> selectMetricKernel<Manhattan, double>(unsigned int);
+    template DistanceKernelT<float> selectMetricKernel<Manhattan, float>(unsigned int);
+    template DistanceKernelT<double> selectMetricKernel<Chebyshev, double>(unsigned int);
+    template DistanceKernelT<float> selectMetricKernel<Chebyshev, float>(unsigned int);
+    template DistanceKernelT<double> selectMetricKernel<Cosine, double>(unsigned int);
+    template DistanceKernelT<float> selectMetricKernel<Cosine, float>(unsigned int);
+
+    template <typename T>
+    DistanceKernelT<T> selectDistanceKernel(unsigned int dims)
+    {
+        return selectMetricKernel<SquaredEuclidean, T>(dims);
+    }
+
+    template DistanceKernelT<double> selectDistanceKernel<double>(unsigned int);
+    template DistanceKernelT<float> selectDistanceKernel<float>(unsigned int);
+
+    template <typename T>
+    DistanceKernelT<T> selectDistanceKernel(unsigned int dims, Metric metric)
+    {
+        switch (metric)
+        {
+            case MANHATTAN: return selectMetricKernel<Manhattan, T>(dims);
+            case COSINE: return selectMetricKernel<Cosine, T>(dims);
+            case CHEBYSHEV: return selectMetricKernel<Chebyshev, T>(dims);
+            // Euclidean kernels are squared either way
+            default: return selectMetricKernel<SquaredEuclidean, T>(dims);
+        }
+    }
+
+    template DistanceKernelT<double> selectDistanceKernel<double>(unsigned int, Metric);
+    template DistanceKernelT<float> selectDistanceKernel<float>(unsigned int, Metric);
+
+    double metricDistance(Metric metric, double value)
+    {
+        return metric == EUCLIDEAN ? Euclidean::distance(value) : value;
+    }
+
+    double distanceSquared(const double *lhs, const double *rhs, unsigned int dims)
+    {
+        return selectDistanceKernel(dims)(lhs, rhs, dims);
+    }
+
+    void addCoords(double *lhs, const double *rhs, unsigned int dims)
+    {
+        switch (dims)
+        {
+            case 2: FixedPoint<2>::add(lhs, rhs); return;
+            case 3: FixedPoint<3>::add(lhs, rhs); return;
+            case 4: FixedPoint<4>::add(lhs, rhs); return;
+            case 8: FixedPoint<8>::add(lhs, rhs); return;
+            case 16: FixedPoint<16>::add(lhs, rhs); return;
+            case 32: FixedPoint<32>::add(lhs, rhs); return;
+            case 64: FixedPoint<64>::add(lhs, rhs); return;
+            default:
+                for (unsigned int i = 0; i < dims; i++)
+                    lhs[i] += rhs[i];
+        }
+    }
+
+    void subtractCoords(double *lhs, const double *rhs, unsigned int dims)
+    {
+        switch (dims)
+        {
+            case 2: FixedPoint<2>::subtract(lhs, rhs); return;
+            case 3: FixedPoint<3>::subtract(lhs, rhs); return;
+            case 4: FixedPoint<4>::subtract(lhs, rhs); return;
+            case 8: FixedPoint<8>::subtract(lhs, rhs); return;
+            case 16: FixedPoint<16>::subtract(lhs, rhs); return;
+            case 32: FixedPoint<32>::subtract(lhs, rhs); return;
+            case 64: FixedPoint<64>::subtract(lhs, rhs); return;
+            default:
+                for (unsigned int i = 0; i < dims; i++)
+                    lhs[i] -= rhs[i];
+        }
+    }
+
+    void addScaledCoords(double *lhs, const double *rhs, double factor, unsigned int dims)
+    {
+        switch (dims)
+        {
+            case 2: FixedPoint<2>::addScaled(lhs, rhs, factor); return;
+            case 3: FixedPoint<3>::addScaled(lhs, rhs, factor); return;
+            case 4: FixedPoint<4>::addScaled(lhs, rhs, factor); return;
+            case 8: FixedPoint<8>::addScaled(lhs, rhs, factor); return;
+            case 16: FixedPoint<16>::addScaled(lhs, rhs, factor); return;
+            case 32: FixedPoint<32>::addScaled(lhs, rhs, factor); return;
+            case 64: FixedPoint<64>::addScaled(lhs, rhs, factor); return;
+            default:
+                for (unsigned int i = 0; i < dims; i++)
+                    lhs[i] += factor * rhs[i];
+        }
+    }
+
+    void scaleCoords(double *lhs, double factor, unsigned int dims)
+    {
+        switch (dims)
+        {
+            case 2: FixedPoint<2>::scale(lhs, factor); return;
+            case 3: FixedPoint<3>::scale(lhs, factor); return;
+            case 4: FixedPoint<4>::scale(lhs, factor); return;
+            case 8: FixedPoint<8>::scale(lhs, factor); return;
+            case 16: FixedPoint<16>::scale(lhs, factor); return;
+            case 32: FixedPoint<32>::scale(lhs, factor); return;
+            case 64: FixedPoint<64>::scale(lhs, factor); return;
+            default:
+                for (unsigned int i = 0; i < dims; i++)
+                    lhs[i] *= factor;
+        }
+    }
+
+    void divideCoords(double *lhs, double divisor, unsigned int dims)
+    {
+        switch (dims)
+        {
+            case 2: FixedPoint<2>::divide(lhs, divisor); return;
+            case 3: FixedPoint<3>::divide(lhs, divisor); return;
+            case 4: FixedPoint<4>::divide(lhs, divisor); return;
+            case 8: FixedPoint<8>::divide(lhs, divisor); return;
+            case 16: FixedPoint<16>::divide(lhs, divisor); return;
+            case 32: FixedPoint<32>::divide(lhs, divisor); return;
+            case 64: FixedPoint<64>::divide(lhs, divisor); return;
+            default:
+                for (unsigned int i = 0; i < dims; i++)
+                    lhs[i] /= divisor;
+        }
+    }
+
+    void copyCoords(double *lhs, const double *rhs, unsigned int dims)
+    {
+        switch (dims)
+        {
+            case 2: FixedPoint<2>::copy(lhs, rhs); return;
+            case 3: FixedPoint<3>::copy(lhs, rhs); return;
+            case 4: FixedPoint<4>::copy(lhs, rhs); return;
+            case 8: FixedPoint<8>::copy(lhs, rhs); return;
+            case 16: FixedPoint<16>::copy(lhs, rhs); return;
+            case 32: FixedPoint<32>::copy(lhs, rhs); return;
+            case 64: FixedPoint<64>::copy(lhs, rhs); return;
+            default:
+                for (unsigned int i = 0; i < dims; i++)
+                    lhs[i] = rhs[i];
+        }
+    }
+
+    unsigned int firstDifference(const double *lhs, const double *rhs, unsigned int dims)
+    {
+        unsigned int i = 0;
+
+        // Test blocks of four with a branch-free OR so the block compare
+        // vectorizes, then locate the exact coordinate in the tail loop
+        for ( ; i + 4 <= dims; i += 4)
+        {
+            bool differs = (lhs[i] != rhs[i]) | (lhs[i + 1] != rhs[i + 1]) |
+                           (lhs[i + 2] != rhs[i + 2]) | (lhs[i + 3] != rhs[i + 3]);
+            if (differs)
+                break;
+        }
+
+        for ( ; i < dims; i++)
+        {
+            if (lhs[i] != rhs[i])
+                break;
+        }
+
+        return i;
+    }
+
+    int compareCoords(const double *lhs, const double *rhs, unsigned int dims)
+    {
+        unsigned int i = firstDifference(lhs, rhs, dims);
+
+        if (i == dims)
+            return 0;
+
+        return (lhs[i] < rhs[i]) ? -1 : 1;
+    }
+
+}
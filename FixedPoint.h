@@ -0,0 +1,222 @@
+// Dimension-specialized coordinate kernels.
+// FixedPoint<D> fixes the number of dimensions at compile time so every loop
+// below has a constant trip count the compiler can fully unroll and vectorize.
+// Point and KMeans dispatch to these at runtime through the dimension.
+// The coordinate type is a parameter so KMeans can run in single precision.
+
+#ifndef CLUSTERING_FIXEDPOINT_H
+#define CLUSTERING_FIXEDPOINT_H
+
+#include <cmath>
+#include <limits>
+
+namespace Clustering {
+
+    // Distance metrics as compile-time policies. A policy turns a pair of
+    // coordinates into a term and folds the terms together; the kernels are
+    // instantiated per policy and dimension, so every metric gets its own
+    // inlined loop. A kernel only has to order pairs like the metric does:
+    // distance() turns a kernel value into the metric's distance.
+    // skips() names centroids a nearest-centroid search must pass over.
+    struct SquaredEuclidean {
+        template <typename T> static T term(T lhs, T rhs) { T difference = lhs - rhs; return difference * difference; }
+        template <typename T> static T combine(T sum, T term) { return sum + term; }
+        template <typename T> static T finish(T sum) { return sum; }
+        template <typename T> static T distance(T value) { return value; }
+        template <typename T> static bool skips(const T *) { return false; }
+    };
+
+    // Kernel values are squared, which orders pairs the same way
+    struct Euclidean : SquaredEuclidean {
+        template <typename T> static T distance(T value) { return std::sqrt(value); }
+    };
+
+    struct Manhattan {
+        template <typename T> static T term(T lhs, T rhs) { return std::fabs(lhs - rhs); }
+        template <typename T> static T combine(T sum, T term) { return sum + term; }
+        template <typename T> static T finish(T sum) { return sum; }
+        template <typename T> static T distance(T value) { return value; }
+        template <typename T> static bool skips(const T *) { return false; }
+    };
+
+    struct Chebyshev {
+        template <typename T> static T term(T lhs, T rhs) { return std::fabs(lhs - rhs); }
+        template <typename T> static T combine(T largest, T term) { return term > largest ? term : largest; }
+        template <typename T> static T finish(T largest) { return largest; }
+        template <typename T> static T distance(T value) { return value; }
+        template <typename T> static bool skips(const T *) { return false; }
+    };
+
+    // 1 - cos for vectors already scaled to unit length. A centroid still at
+    // the max() placeholder of an unseeded cluster has no direction, and its
+    // dot product would overflow to the smallest distance, so it is skipped.
+    struct Cosine {
+        template <typename T> static T term(T lhs, T rhs) { return lhs * rhs; }
+        template <typename T> static T combine(T sum, T term) { return sum + term; }
+        template <typename T> static T finish(T dot) { return 1 - dot; }
+        template <typename T> static T distance(T value) { return value; }
+        template <typename T> static bool skips(const T *centroid)
+        {
+            return !(centroid[0] < std::numeric_limits<T>::max()); // a float row holds it as infinity
+        }
+    };
+
+    // Runtime name of a policy, for choosing a kernel once per run
+    enum Metric { EUCLIDEAN, SQUARED_EUCLIDEAN, MANHATTAN, COSINE, CHEBYSHEV };
+
+    template <unsigned int D, typename T = double>
+    struct FixedPoint {
+        T coords[D];
+
+        // Kernels over raw coordinate arrays of exactly D elements
+        static T distanceSquared(const T *lhs, const T *rhs)
+        {
+            T sum = 0;
+            for (unsigned int i = 0; i < D; i++)
+            {
+                T difference = lhs[i] - rhs[i];
+                sum += difference * difference;
+            }
+            return sum;
+        }
+
+        static void add(T *lhs, const T *rhs)
+        {
+            for (unsigned int i = 0; i < D; i++)
+                lhs[i] += rhs[i];
+        }
+
+        static void subtract(T *lhs, const T *rhs)
+        {
+            for (unsigned int i = 0; i < D; i++)
+                lhs[i] -= rhs[i];
+        }
+
+        static void addScaled(T *lhs, const T *rhs, T factor)
+        {
+            for (unsigned int i = 0; i < D; i++)
+                lhs[i] += factor * rhs[i];
+        }
+
+        static void scale(T *lhs, T factor)
+        {
+            for (unsigned int i = 0; i < D; i++)
+                lhs[i] *= factor;
+        }
+
+        static void divide(T *lhs, T divisor)
+        {
+            for (unsigned int i = 0; i < D; i++)
+                lhs[i] /= divisor;
+        }
+
+        static void copy(T *lhs, const T *rhs)
+        {
+            for (unsigned int i = 0; i < D; i++)
+                lhs[i] = rhs[i];
+        }
+
+        // Value-type helpers
+        FixedPoint &operator+=(const FixedPoint &rhs) { add(coords, rhs.coords); return *this; }
+        FixedPoint &operator-=(const FixedPoint &rhs) { subtract(coords, rhs.coords); return *this; }
+        FixedPoint &operator*=(T factor) { scale(coords, factor); return *this; }
+
+        T distanceSquaredTo(const FixedPoint &rhs) const { return distanceSquared(coords, rhs.coords); }
+
+        // Kernel value of the Policy metric
+        template <typename Policy>
+        static T distance(const T *lhs, const T *rhs)
+        {
+            T sum = Policy::term(lhs[0], rhs[0]);
+            for (unsigned int i = 1; i < D; i++)
+                sum = Policy::combine(sum, Policy::term(lhs[i], rhs[i]));
+            return Policy::finish(sum);
+        }
+    };
+
+    // Kernel of the Policy metric over D coordinates, D == 0 for a length only
+    // known at run time. A loop templated on one of these has the metric and
+    // the trip count inlined into it.
+    template <typename Policy, typename T, unsigned int D>
+    struct MetricKernel {
+        typedef Policy Metric;
+        static T distance(const T *lhs, const T *rhs, unsigned int)
+        {
+            return FixedPoint<D, T>::template distance<Policy>(lhs, rhs);
+        }
+    };
+
+    template <typename Policy, typename T>
+    struct MetricKernel<Policy, T, 0> {
+        typedef Policy Metric;
+        static T distance(const T *lhs, const T *rhs, unsigned int dims)
+        {
+            if (dims == 0)
+                return Policy::finish(T(0));
+
+            T sum = Policy::term(lhs[0], rhs[0]);
+            for (unsigned int i = 1; i < dims; i++)
+                sum = Policy::combine(sum, Policy::term(lhs[i], rhs[i]));
+            return Policy::finish(sum);
+        }
+    };
+
+    // Kernel value of the Policy metric for a dimension known at run time;
+    // the switch inlines with it, where a kernel pointer would be a call
+    template <typename Policy, typename T>
+    inline T metricKernel(const T *lhs, const T *rhs, unsigned int dims)
+    {
+        switch (dims)
+        {
+            case 2: return MetricKernel<Policy, T, 2>::distance(lhs, rhs, dims);
+            case 3: return MetricKernel<Policy, T, 3>::distance(lhs, rhs, dims);
+            case 4: return MetricKernel<Policy, T, 4>::distance(lhs, rhs, dims);
+            case 8: return MetricKernel<Policy, T, 8>::distance(lhs, rhs, dims);
+            case 16: return MetricKernel<Policy, T, 16>::distance(lhs, rhs, dims);
+            case 32: return MetricKernel<Policy, T, 32>::distance(lhs, rhs, dims);
+            case 64: return MetricKernel<Policy, T, 64>::distance(lhs, rhs, dims);
+            default: return MetricKernel<Policy, T, 0>::distance(lhs, rhs, dims);
+        }
+    }
+
+    // Signature shared by the fixed and the generic distance kernels so the
+    // choice can be hoisted out of a hot loop as a single function pointer.
+    template <typename T>
+    using DistanceKernelT = T (*)(const T *, const T *, unsigned int);
+
+    typedef DistanceKernelT<double> DistanceKernel;
+    typedef DistanceKernelT<float> FloatDistanceKernel;
+
+    // Returns the specialized kernel for the instantiated sizes
+    // (2, 3, 4, 8, 16, 32, 64) and the generic loop for everything else.
+    // Instantiated for double and float.
+    template <typename T = double>
+    DistanceKernelT<T> selectDistanceKernel(unsigned int dims);
+
+    // The same per metric: selectMetricKernel<Manhattan>(dims), or by name
+    template <typename Policy, typename T = double>
+    DistanceKernelT<T> selectMetricKernel(unsigned int dims);
+    template <typename T = double>
+    DistanceKernelT<T> selectDistanceKernel(unsigned int dims, Metric metric);
+
+    // Turns a kernel value of the named metric into its distance
+    double metricDistance(Metric metric, double value);
+
+    // Runtime-dimension entry points, dispatching to FixedPoint<D> when possible
+    double distanceSquared(const double *lhs, const double *rhs, unsigned int dims);
+    void addCoords(double *lhs, const double *rhs, unsigned int dims);
+    void subtractCoords(double *lhs, const double *rhs, unsigned int dims);
+    void addScaledCoords(double *lhs, const double *rhs, double factor, unsigned int dims);
+    void scaleCoords(double *lhs, double factor, unsigned int dims);
+    void divideCoords(double *lhs, double divisor, unsigned int dims);
+    void copyCoords(double *lhs, const double *rhs, unsigned int dims);
+
+    // Index of the first coordinate where lhs and rhs differ, dims if none
+    unsigned int firstDifference(const double *lhs, const double *rhs, unsigned int dims);
+
+    // Lexicographic -1/0/1 comparison of two coordinate arrays
+    int compareCoords(const double *lhs, const double *rhs, unsigned int dims);
+
+}
+
+#endif //CLUSTERING_FIXEDPOINT_H
@@ -1,146 +1,1268 @@
 #include "KMeans.h"
 #include "Point.h"
 #include "Cluster.h"
+#include "ThreadPool.h"
+#include "Reduction.h"
+#include "KdTree.h"
+#include "CentroidIndex.h"
+#include "ProductQuantizer.h"
+#include "RandomProjection.h"
+#include "SparseStore.h"
 #include <iostream>
 #include <string>
 #include <sstream>
 #include <fstream>
 #include <vector>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <random>
+#include <future>
+#include <numeric>
 
 //
 using namespace Clustering;
 using namespace std;
 
-double KMeans::mindistance(Point &point, Point centroid)
+constexpr unsigned int KMeans::STOP_CHECK_ROWS;
+constexpr unsigned int KMeans::SCORE_CHUNKS;
+constexpr unsigned int KMeans::REDUCE_PARTITIONS;
+
+double KMeans::mindistance(const Point &point, const Point &centroid)
 {
 
-    double distance = point.distanceTo(centroid);
-    return distance;
+    double distance = __distance(point.data(), centroid.data(), pointdemensions);
+    return metricDistance(__metric, distance);
+}
+
+namespace {
+
+    // The loops below are templated on a MetricKernel, so the metric and
+    // the dimension inline into the loop over centroids or pairs. A run
+    // picks one instantiation through metricLoops() and then only pays an
+    // indirect call per row or per chunk of rows.
+
+    // Index of the centroid row closest to the given point row; the kernel
+    // value (squared for Euclidean) is left in minimaldistance
+    template <typename Kernel, typename T>
+    int nearestCentroid(const T *row, const T *centroids, int k, unsigned int dims, T &minimaldistance)
+    {
+        int clusterindex = 0;
+        minimaldistance = std::numeric_limits<T>::infinity();
+
+        for (int i = 0; i < k; i++)
+        {
+            const T *centroid = centroids + i * dims;
+            if (Kernel::Metric::skips(centroid))
+            {
+                continue;
+            }
+
+            T d = Kernel::distance(row, centroid, dims);
+            if (d < minimaldistance)
+            {
+                minimaldistance = d;
+                clusterindex = i;
+            }
+        }
+
+        return clusterindex;
+    }
+
+    // Assignment of rows [first, last)
+    template <typename Kernel, typename T>
+    void assignRows(const T *const *rows, const T *centroids, int k, unsigned int dims, unsigned int first,
+                    unsigned int last, int *labels, unsigned int &reassigned, double &inertia)
+    {
+        for (unsigned int j = first; j < last; j++)
+        {
+            T d;
+            int clusterindex = nearestCentroid<Kernel>(rows[j], centroids, k, dims, d);
+            inertia += d;
+
+            if (clusterindex != labels[j])
+            {
+                labels[j] = clusterindex;
+                reassigned++;
+            }
+        }
+    }
+
+    // BetaCV sums of rows [first, last) against every later row
+    template <typename Kernel, typename T>
+    void scoreRows(const T *const *rows, const int *labels, unsigned int first, unsigned int last, unsigned int n,
+                   unsigned int dims, CompensatedSum &dIn, CompensatedSum &dOut)
+    {
+        for (unsigned int a = first; a < last; a++)
+        {
+            for (unsigned int b = a + 1; b < n; b++)
+            {
+                double distance = Kernel::Metric::distance(Kernel::distance(rows[a], rows[b], dims));
+                if (labels[a] == labels[b])
+                    dIn.add(distance);
+                else
+                    dOut.add(distance);
+            }
+        }
+    }
+
+    // Sum of kernel values from each row to its centroid
+    template <typename Kernel, typename T>
+    double inertiaRows(const T *const *rows, const int *labels, const T *centroids, unsigned int n,
+                       unsigned int dims)
+    {
+        double sum = 0;
+        for (unsigned int j = 0; j < n; j++)
+        {
+            sum += Kernel::distance(rows[j], centroids + labels[j] * dims, dims);
+        }
+        return sum;
+    }
+
+    template <typename T>
+    struct MetricLoops {
+        int (*nearest)(const T *, const T *, int, unsigned int, T &);
+        void (*assign)(const T *const *, const T *, int, unsigned int, unsigned int, unsigned int, int *,
+                       unsigned int &, double &);
+        void (*score)(const T *const *, const int *, unsigned int, unsigned int, unsigned int, unsigned int,
+                      CompensatedSum &, CompensatedSum &);
+        double (*inertia)(const T *const *, const int *, const T *, unsigned int, unsigned int);
+    };
+
+    template <typename Policy, typename T, unsigned int D>
+    MetricLoops<T> loopsFor()
+    {
+        typedef MetricKernel<Policy, T, D> Kernel;
+
+        MetricLoops<T> loops;
+        loops.nearest = nearestCentroid<Kernel, T>;
+        loops.assign = assignRows<Kernel, T>;
+        loops.score = scoreRows<Kernel, T>;
+        loops.inertia = inertiaRows<Kernel, T>;
+        return loops;
+    }
+
+    template <typename Policy, typename T>
+    MetricLoops<T> metricLoops(unsigned int dims)
+    {
+        switch (dims)
+        {
+            case 2: return loopsFor<Policy, T, 2>();
+            case 3: return loopsFor<Policy, T, 3>();
+            case 4: return loopsFor<Policy, T, 4>();
+            case 8: return loopsFor<Policy, T, 8>();
+            case 16: return loopsFor<Policy, T, 16>();
+            case 32: return loopsFor<Policy, T, 32>();
+            case 64: return loopsFor<Policy, T, 64>();
+            default: return loopsFor<Policy, T, 0>();
+        }
+    }
+
+    // One pointer per row of a store, for the loops above
+    template <typename T>
+    std::vector<const T *> rowPointers(const PointStore &store)
+    {
+        std::vector<const T *> rows(store.getSize());
+        for (unsigned int j = 0; j < rows.size(); j++)
+        {
+            rows[j] = store.row<T>(j);
+        }
+        return rows;
+    }
+
+    // A row added into double sums, widened first if it is a float row
+    inline void addRow(double *sums, const double *row, unsigned int dims)
+    {
+        addCoords(sums, row, dims);
+    }
+
+    inline void addRow(double *sums, const float *row, unsigned int dims)
+    {
+        for (unsigned int d = 0; d < dims; d++)
+        {
+            sums[d] += row[d];
+        }
+    }
+
+    template <typename T>
+    MetricLoops<T> metricLoops(Metric metric, unsigned int dims)
+    {
+        switch (metric)
+        {
+            case SQUARED_EUCLIDEAN: return metricLoops<SquaredEuclidean, T>(dims);
+            case MANHATTAN: return metricLoops<Manhattan, T>(dims);
+            case COSINE: return metricLoops<Cosine, T>(dims);
+            case CHEBYSHEV: return metricLoops<Chebyshev, T>(dims);
+            default: return metricLoops<Euclidean, T>(dims);
+        }
+    }
+
+}
+
+void KMeans::setMetric(Metric metric)
+{
+    __metric = metric;
+    __distance = selectDistanceKernel<double>(pointdemensions, metric);
+
+    // Everything built for the previous metric
+    __tree.reset();
+    __quantizer.reset();
+    if (!__sparseOnly)
+    {
+        __sparse.reset();
+    }
+    __centroidIndex.reset();
 }
 
 void KMeans::run()
 {
+    RunState state;
+    runCurrent(state);
+}
+
+bool KMeans::run(std::chrono::steady_clock::time_point deadline)
+{
+    RunState state;
+    state.deadline = deadline;
+    state.hasDeadline = true;
+    runCurrent(state);
+
+    return state.stats.converged && !state.stats.expired;
+}
+
+KMeans::AsyncRun KMeans::runAsync(ProgressCallback progress)
+{
+    std::shared_ptr<std::atomic<bool> > cancel = std::make_shared<std::atomic<bool> >(false);
+
+    std::shared_future<RunStats> result = std::async(std::launch::async, [this, cancel, progress]() {
+        RunState state;
+        state.cancel = cancel.get();
+        state.progress = progress;
+        runCurrent(state);
+        return state.stats;
+    }).share();
+
+    return AsyncRun(result, cancel);
+}
+
+void KMeans::runCurrent(RunState &state)
+{
+    if (__labelsStale)
+    {
+        absorb();
+    }
 
-    while (scorediff > SCORE_DIFF_THRESHOLD)
+    state.labels = __labels;
+    state.centroids = __centroidValues;
+
+    if (!__storePlaced)
     {
-        for (int i = 0; i < k; i++)
+        placeStore();
+    }
+
+    if (__projectionDims > 0 && __projectionDims < pointdemensions)
+    {
+        runProjected(state);
+    }
+    else
+    {
+        prepareAlgorithm();
+        lloyd(state);
+    }
+    adopt(state);
+
+    __runStats.assign(1, state.stats);
+    __bestRun = 0;
+}
+
+void KMeans::runProjected(RunState &state)
+{
+    std::shared_ptr<ThreadPool> pool = threadPool();
+    auto start = std::chrono::steady_clock::now();
+
+    unsigned int n = getRows();
+    unsigned int dims = __projectionDims;
+    RandomProjection projection(pointdemensions, dims, __projectionSeed);
+
+    std::vector<Point> reduced(n, Point(dims));
+    pool->parallelFor(0, n, STOP_CHECK_ROWS, [&](unsigned int, unsigned int first, unsigned int last) {
+        std::vector<double> buffer;
+        for (unsigned int j = first; j < last; j++)
+        {
+            projection.project(rowData(j, buffer), reduced[j].data());
+        }
+    }, true);
+
+    // A KMeans over the projected points, starting from the projection of
+    // this clustering; a centroid still at infinity stays there. Its
+    // clusters are never seen, so they leave the global ids alone.
+    KMeans inner(dims, k, "", __precision, true);
+    inner.setConvergence(__convergence);
+    inner.setAlgorithm(__algorithm);
+    inner.setMetric(__metric);
+    inner.setQuantization(__quantization);
+    inner.setThreadPool(*pool);
+
+    std::vector<std::vector<PointPtr> > members(k);
+    for (unsigned int j = 0; j < n; j++)
+    {
+        members[state.labels[j]].push_back(&reduced[j]);
+    }
+    for (int i = 0; i < k; i++)
+    {
+        const double *centroid = &state.centroids[i * pointdemensions];
+        Point projected(dims);
+        if (centroid[0] == std::numeric_limits<double>::max())
+        {
+            for (unsigned int d = 0; d < dims; d++)
+            {
+                projected.data()[d] = centroid[0];
+            }
+        }
+        else
+        {
+            projection.project(centroid, projected.data());
+        }
+
+        inner[i].addAll(members[i]);
+        inner[i].setCentroid(projected);
+    }
+
+    RunState reducedState;
+    reducedState.hasDeadline = state.hasDeadline;
+    reducedState.deadline = state.deadline;
+    reducedState.cancel = state.cancel;
+    reducedState.progress = state.progress;
+    inner.runCurrent(reducedState);
+
+    // The inner run numbers its rows itself
+    for (unsigned int j = 0; j < n; j++)
+    {
+        state.labels[j] = reducedState.labels[reduced[j].getIndex()];
+    }
+
+    // Centroids in the original space, as the update step computes them
+    std::vector<double> sums(k * pointdemensions, 0.0);
+    std::vector<unsigned int> counts(k);
+    std::vector<double> buffer;
+    for (unsigned int j = 0; j < n; j++)
+    {
+        if (__sparseOnly)
+            __sparse->addTo(j, &sums[state.labels[j] * pointdemensions]);
+        else
+            addCoords(&sums[state.labels[j] * pointdemensions], rowData(j, buffer), pointdemensions);
+        counts[state.labels[j]]++;
+    }
+    for (int i = 0; i < k; i++)
+    {
+        if (counts[i] > 0)
+        {
+            divideCoords(&sums[i * pointdemensions], counts[i], pointdemensions);
+            copyCoords(&state.centroids[i * pointdemensions], &sums[i * pointdemensions], pointdemensions);
+        }
+    }
+
+    double seconds = state.stats.seconds;
+    state.stats = reducedState.stats;
+    if (!std::isnan(state.stats.betacv))
+    {
+        state.stats.betacv = betaCV(state.labels, k, &state);
+        state.stats.expired = std::isnan(state.stats.betacv);
+    }
+    state.stats.inertia = inertia(state.labels, state.centroids);
+    state.stats.seconds = seconds + std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void KMeans::prepareAlgorithm()
+{
+    if (!__storePlaced)
+    {
+        placeStore();
+    }
+
+    if (!isEuclidean() || __sparseOnly)
+    {
+        return;
+    }
+
+    if (__algorithm == FILTERING && !__tree)
+    {
+        __tree = std::make_shared<const KdTree>(__points, pointdemensions);
+    }
+
+    if (__sparseRows && !__sparse)
+    {
+        std::shared_ptr<SparseStore> sparse = std::make_shared<SparseStore>(pointdemensions);
+        for (unsigned int j = 0; j < __points.size(); j++)
+        {
+            sparse->appendRow(__points[j]->data());
+        }
+        __sparse = sparse;
+    }
+
+    if (__algorithm == QUANTIZED && !__quantizer)
+    {
+        std::shared_ptr<ThreadPool> pool = threadPool();
+        __quantizer = std::make_shared<const ProductQuantizer>(__points, pointdemensions, __quantization.subspaces,
+                                                               __quantization.codewords, __quantization.seed,
+                                                               __quantization.iterations, *pool);
+    }
+}
+
+const double *KMeans::rowData(unsigned int j, std::vector<double> &buffer) const
+{
+    if (__sparseOnly)
+    {
+        buffer.resize(pointdemensions);
+        __sparse->copyTo(j, buffer.data());
+        return buffer.data();
+    }
+
+    if (__precision == SINGLE_PRECISION)
+    {
+        const float *row = __store.floatRow(j);
+        buffer.assign(row, row + pointdemensions);
+        return buffer.data();
+    }
+
+    return __rows[j];
+}
+
+bool KMeans::loadSparse(std::istream &is)
+{
+    // The first line decides; a dense file is left to the Cluster reader
+    std::string line;
+    std::streampos start = is.tellg();
+    if (!std::getline(is, line) || line.find(':') == std::string::npos)
+    {
+        is.clear();
+        is.seekg(start);
+        return false;
+    }
+
+    // Blank and malformed lines are skipped, as the Cluster reader does
+    std::shared_ptr<SparseStore> sparse = std::make_shared<SparseStore>(pointdemensions);
+    SparseStore::Entries entries;
+    do
+    {
+        if (line.find_first_not_of(" \t\r") != std::string::npos &&
+            SparseStore::parseRow(line, pointdemensions, entries))
+        {
+            sparse->appendEntries(entries);
+        }
+    } while (std::getline(is, line));
+
+    __sparse = sparse;
+    __sparseRows = true;
+    __sparseOnly = true;
+    __labels.assign(sparse->getSize(), 0);
+
+    // Starting centroids drawn from the rows, as pickPoints does for Points
+    std::vector<double> centroids = seedCentroids(0, k);
+    for (int i = 0; i < k; i++)
+    {
+        Point centroid(pointdemensions);
+        copyCoords(centroid.data(), &centroids[i * pointdemensions], pointdemensions);
+        clusterarray[i].setCentroid(centroid);
+    }
+
+    return true;
+}
+
+int KMeans::rerankedNearest(unsigned int row, const double *centroids, int clusters,
+                            const std::vector<double> &tables, std::vector<std::pair<double, int> > &shortlist,
+                            std::vector<double> &buffer, double &distance) const
+{
+    // The `rerank` lowest approximate distances, kept sorted
+    unsigned int width = __quantizer->getSubspaces() * __quantizer->getCodewords();
+    unsigned int rerank = std::max(1u, std::min(__quantization.rerank, static_cast<unsigned int>(clusters)));
+    const unsigned char *code = __quantizer->code(row);
+
+    shortlist.clear();
+    for (int i = 0; i < clusters; i++)
+    {
+        double approximate = __quantizer->distance(code, &tables[i * width]);
+        if (shortlist.size() < rerank || approximate < shortlist.back().first)
         {
-            LNodePtr current = clusterarray[i].getheadpointer();
-            double minimaldistance = 99999;
-            while (current != nullptr)
+            if (shortlist.size() == rerank)
             {
-                bool checkswap = false;
-                bool swap = false;
-                int clusterindex = -1;
-                for (int i2 = 0; i2 < k; i2++)
+                shortlist.pop_back();
+            }
+            shortlist.insert(std::upper_bound(shortlist.begin(), shortlist.end(), std::make_pair(approximate, i)),
+                             std::make_pair(approximate, i));
+        }
+    }
+
+    // Exact distances decide among them, ties to the lowest index; QUANTIZED
+    // runs are always Euclidean
+    const double *coords = rowData(row, buffer);
+    int clusterindex = shortlist[0].second;
+    distance = metricKernel<SquaredEuclidean>(coords, centroids + clusterindex * pointdemensions, pointdemensions);
+    for (unsigned int c = 1; c < shortlist.size(); c++)
+    {
+        int i = shortlist[c].second;
+        double d = metricKernel<SquaredEuclidean>(coords, centroids + i * pointdemensions, pointdemensions);
+        if (d < distance || (d == distance && i < clusterindex))
+        {
+            distance = d;
+            clusterindex = i;
+        }
+    }
+
+    return clusterindex;
+}
+
+void KMeans::lloyd(RunState &state) const
+{
+    std::shared_ptr<ThreadPool> pool = threadPool();
+    auto start = std::chrono::steady_clock::now();
+
+    unsigned int n = getRows();
+    int clusters = state.centroids.size() / pointdemensions;
+    Algorithm algorithm = (isEuclidean() && !__sparseOnly) ? __algorithm : LLOYD;
+    MetricLoops<double> loops = metricLoops<double>(__metric, pointdemensions);
+    MetricLoops<float> floatLoops = metricLoops<float>(__metric, pointdemensions);
+    std::vector<const float *> floatRows;
+    if (__precision == SINGLE_PRECISION)
+    {
+        floatRows = rowPointers<float>(__store);
+    }
+
+    // Per-run copy so concurrent runs only share the point rows
+    PointStore centroids(pointdemensions, __precision);
+    for (int i = 0; i < clusters; i++)
+    {
+        centroids.appendRow(&state.centroids[i * pointdemensions]);
+    }
+
+    // Assignment tasks cover fixed row ranges, so the per-chunk partial
+    // results are combined in the same order for any number of threads;
+    // they are placed like the first touch of the rows in absorb()
+    unsigned int chunks = (n + STOP_CHECK_ROWS - 1) / STOP_CHECK_ROWS;
+    std::vector<unsigned int> chunkReassigned(chunks);
+    std::vector<double> chunkInertia(chunks);
+
+    // The centroid sums likewise go to a fixed number of partitions, each
+    // with its own k x d buffer, reduced as a pairwise tree
+    unsigned int partitions = std::max(1u, std::min(chunks, REDUCE_PARTITIONS));
+    std::vector<unsigned int> partitionBounds;
+    for (unsigned int p = 0; p <= partitions; p++)
+    {
+        partitionBounds.push_back(static_cast<unsigned long long>(n) * p / partitions);
+    }
+    std::vector<std::vector<double> > sums(partitions, std::vector<double>(clusters * pointdemensions));
+    std::vector<std::vector<unsigned int> > counts(partitions, std::vector<unsigned int>(clusters));
+
+    // INDEXED keeps its index across iterations and, per row, a lower bound
+    // on the distance to every centroid but its own (Hamerly). The last
+    // update moved the centroids in `moved`, by drift; the largest drift
+    // bounds how much closer another centroid can have come.
+    CentroidIndex index(pointdemensions);
+    std::vector<double> lowerBounds(algorithm == INDEXED ? n : 0, 0.0);
+    std::vector<double> drift(clusters, 0.0);
+    std::vector<unsigned int> moved;
+    int fastest = -1;
+    double maxDrift = 0, otherDrift = 0; // largest, and largest of the others
+    const SparseStore *sparse = (algorithm == LLOYD) ? __sparse.get() : nullptr;
+    std::vector<double> centroidNorms(clusters);
+    std::vector<double> tables;
+    if (algorithm == QUANTIZED && __quantizer)
+    {
+        tables.resize(clusters * __quantizer->getSubspaces() * __quantizer->getCodewords());
+    }
+
+    double previousInertia = -1;
+    bool stop = (n == 0);
+    bool expired = false;
+    state.stats.converged = stop;
+    while (!stop && !(expired = state.interrupted()))
+    {
+        for (int i = 0; i < clusters; i++)
+        {
+            centroids.setRow(i, &state.centroids[i * pointdemensions]);
+        }
+
+        unsigned int reassigned = 0;
+        double assignedInertia = 0;
+
+        if (algorithm == FILTERING && __tree)
+        {
+            // Assignment and centroid sums in one walk over the tree; it is
+            // only interrupted between iterations
+            std::fill(sums[0].begin(), sums[0].end(), 0.0);
+            std::fill(counts[0].begin(), counts[0].end(), 0);
+            __tree->filter(state.centroids.data(), clusters, state.labels, sums[0].data(), counts[0].data(),
+                           reassigned, assignedInertia);
+        }
+        else
+        {
+            if (algorithm == INDEXED && state.stats.iterations == 0)
+            {
+                index.rebuild(state.centroids.data(), clusters, *pool);
+            }
+            else if (algorithm == INDEXED)
+            {
+                index.update(moved, *pool);
+            }
+            if (!tables.empty())
+            {
+                unsigned int width = __quantizer->getSubspaces() * __quantizer->getCodewords();
+                for (int i = 0; i < clusters; i++)
+                {
+                    __quantizer->table(&state.centroids[i * pointdemensions], &tables[i * width]);
+                }
+            }
+            if (sparse)
+            {
+                for (int i = 0; i < clusters; i++)
                 {
+                    const double *centroid = &state.centroids[i * pointdemensions];
+                    centroidNorms[i] = std::inner_product(centroid, centroid + pointdemensions, centroid, 0.0);
+                }
+            }
+
+            // Assignment; the inertia falls out of the nearest-centroid search
+            std::atomic<bool> cut(false);
+            pool->parallelFor(0, n, STOP_CHECK_ROWS, [&](unsigned int chunk, unsigned int first, unsigned int last) {
+                chunkReassigned[chunk] = 0;
+                chunkInertia[chunk] = 0;
 
-                    double distance = mindistance(*(current->p), clusterarray[i2].getCentroid());
-                    if (distance < minimaldistance)
+                // Interrupted mid-sweep: every label changed so far is closer to
+                // the current centroids than before, so keep them as they are
+                if (cut || (first > 0 && state.interrupted()))
+                {
+                    cut = true;
+                    return;
+                }
+
+                // Dense rows: the whole chunk in one call of the metric's loop
+                if (!sparse && tables.empty() && algorithm != INDEXED)
+                {
+                    if (__precision == SINGLE_PRECISION)
+                        floatLoops.assign(floatRows.data(), centroids.floatRow(0), clusters, pointdemensions,
+                                          first, last, state.labels.data(), chunkReassigned[chunk], chunkInertia[chunk]);
+                    else
+                        loops.assign(__rows.data(), centroids.doubleRow(0), clusters, pointdemensions,
+                                     first, last, state.labels.data(), chunkReassigned[chunk], chunkInertia[chunk]);
+                    return;
+                }
+
+                std::vector<std::pair<double, int> > shortlist;
+                std::vector<double> buffer;
+                for (unsigned int j = first; j < last; j++)
+                {
+                    int clusterindex;
+
+                    if (sparse && !isEuclidean())
                     {
-                        minimaldistance = distance;
-                        clusterindex = i2;
-                        checkswap = true;
+                        double d;
+                        clusterindex = loops.nearest(rowData(j, buffer), state.centroids.data(), clusters,
+                                                     pointdemensions, d);
+                        chunkInertia[chunk] += d;
+                    }
+                    else if (sparse)
+                    {
+                        double d = sparse->distanceSquared(j, &state.centroids[0], centroidNorms[0]);
+                        clusterindex = 0;
+                        for (int i = 1; i < clusters; i++)
+                        {
+                            double candidate = sparse->distanceSquared(j, &state.centroids[i * pointdemensions],
+                                                                       centroidNorms[i]);
+                            if (candidate < d)
+                            {
+                                d = candidate;
+                                clusterindex = i;
+                            }
+                        }
+                        chunkInertia[chunk] += d;
+                    }
+                    else if (!tables.empty())
+                    {
+                        double d;
+                        clusterindex = rerankedNearest(j, state.centroids.data(), clusters, tables, shortlist,
+                                                       buffer, d);
+                        chunkInertia[chunk] += d;
+                    }
+                    else
+                    {
+                        // The own centroid is still nearest if it is closer
+                        // than half its separation from the others, or than
+                        // the row's bound on them; otherwise search
+                        const double *row = rowData(j, buffer);
+                        clusterindex = state.labels[j];
+                        double d = __distance(row, &state.centroids[clusterindex * pointdemensions], pointdemensions);
+                        lowerBounds[j] -= (clusterindex == fastest) ? otherDrift : maxDrift;
+                        if (!(std::sqrt(d) < std::max(index.separation(clusterindex) / 2, lowerBounds[j])))
+                        {
+                            clusterindex = index.nearest(row, clusterindex, d, &lowerBounds[j]);
+                        }
+                        chunkInertia[chunk] += d;
                     }
 
+                    if (clusterindex != state.labels[j])
+                    {
+                        state.labels[j] = clusterindex;
+                        chunkReassigned[chunk]++;
+                    }
                 }
-                if (clusterindex != i && checkswap)
+            }, true);
+            expired = cut;
+
+            reassigned = treeReduce(chunkReassigned);
+            assignedInertia = treeReduce(chunkInertia);
+
+            if (expired)
+            {
+                break;
+            }
+
+            // New centroids in one pass over the labels, always summed in double;
+            // a cluster left empty keeps its previous centroid. The partitions
+            // are contiguous row ranges too, placed like the assignment chunks.
+            pool->parallelFor(partitionBounds, [&](unsigned int p, unsigned int first, unsigned int last) {
+                std::fill(sums[p].begin(), sums[p].end(), 0.0);
+                std::fill(counts[p].begin(), counts[p].end(), 0);
+                for (unsigned int j = first; j < last; j++)
                 {
-                    Cluster::Move moveclusters(current->p, &clusterarray[i], &clusterarray[clusterindex]);
-                    moveclusters.perform();
-                    current = clusterarray[i].getheadpointer();
-                    swap = true;
+                    double *sum = &sums[p][state.labels[j] * pointdemensions];
+                    if (sparse)
+                        sparse->addTo(j, sum);
+                    else if (__precision == SINGLE_PRECISION)
+                        addRow(sum, floatRows[j], pointdemensions);
+                    else
+                        addRow(sum, __rows[j], pointdemensions);
+                    counts[p][state.labels[j]]++;
                 }
+            }, true);
+            treeReduceInto(sums);
+            treeReduceInto(counts);
+        }
 
-                if (swap == false)
+        double maxShift = 0;
+        std::fill(drift.begin(), drift.end(), 0.0);
+        moved.clear();
+        for (int i = 0; i < clusters; i++)
+        {
+            if (counts[0][i] > 0)
+            {
+                double *centroid = &state.centroids[i * pointdemensions];
+                double *mean = &sums[0][i * pointdemensions];
+                divideCoords(mean, counts[0][i], pointdemensions);
+                if (__metric == COSINE)
                 {
-                    current = current->next;
+                    double norm = sqrt(std::inner_product(mean, mean + pointdemensions, mean, 0.0));
+                    if (norm > 0)
+                    {
+                        divideCoords(mean, norm, pointdemensions);
+                    }
+                }
+                double shift = __distance(centroid, mean, pointdemensions);
+                maxShift = std::max(maxShift, metricDistance(__metric, shift));
+                drift[i] = std::sqrt(shift);
+                if (firstDifference(centroid, mean, pointdemensions) < pointdemensions)
+                {
+                    moved.push_back(i);
                 }
-                minimaldistance = 99999;
+                copyCoords(centroid, mean, pointdemensions);
             }
         }
 
-        for (int index = 0; index < k; index++)
+        fastest = -1;
+        maxDrift = otherDrift = 0;
+        for (int i = 0; i < clusters; i++)
         {
-            if (!clusterarray[index].isCentroidValid())
+            if (drift[i] > maxDrift)
             {
-                clusterarray[index].computeCentroid();
+                otherDrift = maxDrift;
+                maxDrift = drift[i];
+                fastest = i;
             }
+            else
+            {
+                otherDrift = std::max(otherDrift, drift[i]);
+            }
+        }
+
+        state.stats.iterations++;
+        state.stats.reassigned = reassigned;
+        state.stats.shift = maxShift;
+
+        if (__convergence.scoreEveryIteration)
+        {
+            state.stats.betacv = betaCV(state.labels, clusters, &state);
+            expired = std::isnan(state.stats.betacv);
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        state.stats.converged = reassigned <= __convergence.maxReassigned ||
+                                maxShift <= __convergence.maxShift;
+
+        if (previousInertia > 0 &&
+            std::fabs(previousInertia - assignedInertia) <= __convergence.minInertiaChange * previousInertia)
+        {
+            state.stats.converged = true;
         }
+        previousInertia = assignedInertia;
 
-        int betaCV = computeClusteringScore();
+        stop = state.stats.converged ||
+               state.stats.iterations >= __convergence.maxIterations ||
+               (__convergence.maxSeconds > 0 && seconds >= __convergence.maxSeconds);
 
-        scorediff = abs(score - betaCV);
-        score = betaCV;
+        if (state.progress)
+        {
+            Progress progress;
+            progress.iteration = state.stats.iterations;
+            progress.reassigned = reassigned;
+            progress.betacv = __convergence.scoreEveryIteration ? state.stats.betacv
+                                                                : std::numeric_limits<double>::quiet_NaN();
+            progress.inertia = assignedInertia;
+            progress.seconds = seconds;
+            state.progress(progress);
+        }
+    }
+
+    // The quadratic score is skipped once the run was interrupted, and
+    // abandoned if the interruption comes while it runs
+    if (expired && !__convergence.scoreEveryIteration)
+    {
+        state.stats.betacv = std::numeric_limits<double>::quiet_NaN();
+    }
+    else if (!__convergence.scoreEveryIteration || state.stats.iterations == 0)
+    {
+        state.stats.betacv = betaCV(state.labels, clusters, &state);
+        expired = std::isnan(state.stats.betacv);
     }
 
+    // Recall of the QUANTIZED step against the final centroids, at the cost
+    // of one exact assignment pass; NaN if it is interrupted
+    if (!tables.empty() && !expired)
+    {
+        unsigned int width = __quantizer->getSubspaces() * __quantizer->getCodewords();
+        for (int i = 0; i < clusters; i++)
+        {
+            __quantizer->table(&state.centroids[i * pointdemensions], &tables[i * width]);
+        }
+
+        std::vector<unsigned int> chunkExact(chunks);
+        std::atomic<bool> cut(false);
+        pool->parallelFor(0, n, STOP_CHECK_ROWS, [&](unsigned int chunk, unsigned int first, unsigned int last) {
+            std::vector<std::pair<double, int> > shortlist;
+            std::vector<double> buffer;
+            chunkExact[chunk] = 0;
+            if (cut || state.interrupted())
+            {
+                cut = true;
+                return;
+            }
+            for (unsigned int j = first; j < last; j++)
+            {
+                double approximate, exact;
+                int clusterindex = rerankedNearest(j, state.centroids.data(), clusters, tables, shortlist, buffer,
+                                                   approximate);
+                if (clusterindex == loops.nearest(rowData(j, buffer), state.centroids.data(), clusters,
+                                                  pointdemensions, exact))
+                {
+                    chunkExact[chunk]++;
+                }
+            }
+        }, true);
+        expired = cut;
+        state.stats.recall = expired ? std::numeric_limits<double>::quiet_NaN()
+                                     : static_cast<double>(treeReduce(chunkExact)) / n;
+    }
 
+    // Read after the score and the recall pass, which a cancel also stops
+    state.stats.cancelled = state.cancel != nullptr && state.cancel->load(std::memory_order_relaxed);
+    state.stats.expired = expired;
+    state.stats.clusters = clusters;
+    state.stats.degenerate = isDegenerate(state.labels, clusters);
+    state.stats.inertia = inertia(state.labels, state.centroids);
+    state.stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 }
 
+void KMeans::adopt(const RunState &state)
+{
+    if (state.stats.iterations > 0 || state.labels != __labels)
+    {
+        __labels = state.labels;
+        __centroidValues = state.centroids;
+        __centroidIndex.reset();
+        __clustersStale = true;
+    }
+
+    score = state.stats.betacv;
+}
 
-double KMeans::computeClusteringScore()
+void KMeans::runRestarts(unsigned int restarts, unsigned int seed, unsigned int threads)
 {
-        double dIn = 0;
+    std::shared_ptr<ThreadPool> pool = threadPool();
+    if (__labelsStale)
+    {
+        absorb();
+    }
+    prepareAlgorithm();
+
+    if (threads == 0)
+    {
+        threads = pool->getThreads();
+    }
+    threads = std::min(threads, restarts);
+
+    // `threads` tasks pull runs until none are left, so at most that many
+    // runs are in flight; each run's own assignment shares the same pool
+    std::vector<RunState> states(restarts);
+    std::atomic<unsigned int> next(0);
+    pool->parallelFor(0, threads, 1, [&](unsigned int, unsigned int, unsigned int) {
+        for (unsigned int r = next++; r < restarts; r = next++)
+        {
+            RunState &state = states[r];
+            state.stats.seed = seed + r;
+            state.labels.assign(getRows(), 0);
+            state.centroids = seedCentroids(state.stats.seed, k);
+            lloyd(state);
+        }
+    });
 
-        for (int index = 0; index < k; index++)
+    __runStats.clear();
+    __bestRun = 0;
+    for (unsigned int r = 0; r < restarts; r++)
+    {
+        __runStats.push_back(states[r].stats);
+        if (betterRun(states[r].stats, states[__bestRun].stats))
         {
-            double sum = clusterarray[index].intraClusterDistance();
-            dIn += sum;
+            __bestRun = r;
         }
+    }
+
+    if (restarts > 0)
+    {
+        adopt(states[__bestRun]);
+    }
+}
+
+bool KMeans::betterRun(const RunStats &lhs, const RunStats &rhs)
+{
+    // 0: scored, 1: degenerate, 2: no score
+    int lhsRank = std::isnan(lhs.betacv) ? 2 : (lhs.degenerate ? 1 : 0);
+    int rhsRank = std::isnan(rhs.betacv) ? 2 : (rhs.degenerate ? 1 : 0);
 
-        double dOut = 0;
+    if (lhsRank != rhsRank)
+    {
+        return lhsRank < rhsRank;
+    }
+
+    return (lhsRank == 0) ? lhs.betacv < rhs.betacv : lhs.inertia < rhs.inertia;
+}
+
+std::vector<double> KMeans::seedCentroids(unsigned int seed, int clusters) const
+{
+    // k distinct rows drawn with a partial Fisher-Yates shuffle; like
+    // pickPoints, clusters beyond the number of points start at infinity
+    std::mt19937 generator(seed);
+    std::vector<unsigned int> rows(getRows());
+    for (unsigned int j = 0; j < rows.size(); j++)
+    {
+        rows[j] = j;
+    }
 
-        int i = 0;
-        int i2 = 1;
+    std::vector<double> centroids(clusters * pointdemensions, std::numeric_limits<double>::max());
+    std::vector<double> buffer;
+    for (unsigned int i = 0; i < static_cast<unsigned int>(clusters) && i < rows.size(); i++)
+    {
+        std::uniform_int_distribution<unsigned int> pick(i, rows.size() - 1);
+        std::swap(rows[i], rows[pick(generator)]);
+        copyCoords(&centroids[i * pointdemensions], rowData(rows[i], buffer), pointdemensions);
+    }
+
+    return centroids;
+}
 
-        while (i < k)
+
+double KMeans::computeClusteringScore()
+{
+    if (__labelsStale)
+    {
+        absorb();
+    }
+    if (!__storePlaced)
+    {
+        placeStore();
+    }
+
+    return betaCV(__labels, k);
+}
+
+double KMeans::betaCV(const std::vector<int> &labels, int clusters, const RunState *state) const
+{
+    std::shared_ptr<ThreadPool> pool = threadPool();
+    unsigned int n = getRows();
+    const SparseStore *sparse = isEuclidean() ? __sparse.get() : nullptr;
+    MetricLoops<double> loops = metricLoops<double>(__metric, pointdemensions);
+    MetricLoops<float> floatLoops = metricLoops<float>(__metric, pointdemensions);
+    bool single = !sparse && !__sparseOnly && __precision == SINGLE_PRECISION;
+    std::vector<const float *> floatRows;
+    if (single)
+    {
+        floatRows = rowPointers<float>(__store);
+    }
+
+    // Row a pairs with the n - a - 1 rows after it, so the chunks are cut by
+    // pair count rather than by rows; the chunk count does not depend on the
+    // pool, keeping the sums identical for any number of threads
+    std::vector<double> pairs(n);
+    for (unsigned int a = 0; a < n; a++)
+    {
+        pairs[a] = n - a - 1;
+    }
+    std::vector<unsigned int> bounds = ThreadPool::weightedBounds(pairs, std::min(n, SCORE_CHUNKS));
+    std::vector<CompensatedSum> chunkIn(bounds.size() - 1), chunkOut(bounds.size() - 1);
+
+    // Every pair of rows is either an intra- or an inter-cluster edge; the
+    // sums run over millions of similar terms, hence the compensation. A row
+    // pairs with up to n others, so a run's interruption is checked per row.
+    std::atomic<bool> cut(false);
+    pool->parallelFor(bounds, [&](unsigned int chunk, unsigned int first, unsigned int last) {
+        CompensatedSum dIn;
+        CompensatedSum dOut;
+        std::vector<double> rowBuffer, otherBuffer;
+        for (unsigned int a = first; a < last; a++)
         {
-            while (i2 < k)
+            if (cut || (state != nullptr && state->interrupted()))
+            {
+                cut = true;
+                return;
+            }
+
+            if (single)
             {
-                double sum = interClusterDistance(clusterarray[i], clusterarray[i2]);
-                dOut += sum;
-                i2++;
+                floatLoops.score(floatRows.data(), labels.data(), a, a + 1, n, pointdemensions, dIn, dOut);
+                continue;
+            }
+            if (!sparse && !__sparseOnly)
+            {
+                loops.score(__rows.data(), labels.data(), a, a + 1, n, pointdemensions, dIn, dOut);
+                continue;
+            }
+
+            // Sparse rows; other metrics than Euclidean expand both rows of a pair
+            const double *row = sparse ? nullptr : rowData(a, rowBuffer);
+            for (unsigned int b = a + 1; b < n; b++)
+            {
+                double distance = metricDistance(__metric, sparse ? sparse->distanceSquared(a, b)
+                                                                  : __distance(row, rowData(b, otherBuffer),
+                                                                               pointdemensions));
+                if (labels[a] == labels[b])
+                    dIn.add(distance);
+                else
+                    dOut.add(distance);
             }
-            i++;
-            i2 = i + 1;
         }
-        double pIn = 0;
-        for (int index = 0; index < k; index++)
+        chunkIn[chunk] = dIn;
+        chunkOut[chunk] = dOut;
+    }, true);
+
+    if (cut)
+    {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    double dIn = treeReduce(chunkIn).value();
+    double dOut = treeReduce(chunkOut).value();
+
+    std::vector<double> sizes(clusters);
+    for (unsigned int j = 0; j < n; j++)
+    {
+        sizes[labels[j]]++;
+    }
+
+    double pIn = 0;
+    double pOut = 0;
+    double seen = 0;
+    for (int index = 0; index < clusters; index++)
+    {
+        pIn += sizes[index] * (sizes[index] - 1) / 2;
+        pOut += sizes[index] * seen;
+        seen += sizes[index];
+    }
+
+    if(dIn == 0 || pIn == 0 || dOut == 0 || pOut == 0)
+    {
+        return 0;
+    }
+
+    return (dIn / pIn) / (dOut / pOut);
+}
+
+bool KMeans::isDegenerate(const std::vector<int> &labels, int clusters)
+{
+    // BetaCV needs a pair inside some cluster and a pair across two
+    std::vector<unsigned int> sizes(clusters);
+    for (unsigned int j = 0; j < labels.size(); j++)
+    {
+        sizes[labels[j]]++;
+    }
+
+    int nonempty = 0;
+    bool pairs = false;
+    for (int i = 0; i < clusters; i++)
+    {
+        nonempty += (sizes[i] > 0);
+        pairs = pairs || (sizes[i] > 1);
+    }
+
+    return nonempty < 2 || !pairs;
+}
+
+double KMeans::inertia(const std::vector<int> &labels, const std::vector<double> &centroids) const
+{
+    std::shared_ptr<ThreadPool> pool = threadPool();
+    unsigned int n = labels.size();
+    const SparseStore *sparse = isEuclidean() ? __sparse.get() : nullptr;
+    bool dense = !sparse && !__sparseOnly;
+    MetricLoops<double> loops = metricLoops<double>(__metric, pointdemensions);
+    MetricLoops<float> floatLoops = metricLoops<float>(__metric, pointdemensions);
+
+    bool single = dense && __precision == SINGLE_PRECISION;
+    std::vector<const float *> floatRows;
+    PointStore floatCentroids(pointdemensions, SINGLE_PRECISION);
+    for (unsigned int i = 0; single && i < centroids.size(); i += pointdemensions)
+    {
+        floatCentroids.appendRow(&centroids[i]);
+    }
+    if (single)
+    {
+        floatRows = rowPointers<float>(__store);
+    }
+
+    // Over the assignment's chunks and placed like them; the partial sums
+    // are combined in a fixed order
+    std::vector<double> chunkSums((n + STOP_CHECK_ROWS - 1) / STOP_CHECK_ROWS);
+    pool->parallelFor(0, n, STOP_CHECK_ROWS, [&](unsigned int chunk, unsigned int first, unsigned int last) {
+        if (single)
         {
-            double sum = clusterarray[index].getClusterEdges();
-            pIn += sum;
+            chunkSums[chunk] = floatLoops.inertia(&floatRows[first], &labels[first], floatCentroids.floatRow(0),
+                                                  last - first, pointdemensions);
+            return;
         }
-        double pOut = 0;
+        if (dense)
+        {
+            chunkSums[chunk] = loops.inertia(&__rows[first], &labels[first], centroids.data(), last - first,
+                                             pointdemensions);
+            return;
+        }
+
+        std::vector<double> buffer;
+        double sum = 0;
+        for (unsigned int j = first; j < last; j++)
+        {
+            const double *centroid = &centroids[labels[j] * pointdemensions];
+            if (sparse)
+                sum += sparse->distanceSquared(j, centroid,
+                                               std::inner_product(centroid, centroid + pointdemensions, centroid, 0.0));
+            else
+                sum += __distance(rowData(j, buffer), centroid, pointdemensions);
+        }
+        chunkSums[chunk] = sum;
+    }, true);
+
+    return treeReduce(chunkSums);
+}
+
+std::vector<KMeans::RunStats> KMeans::sweep(int kmin, int kmax, unsigned int seed, unsigned int threads)
+{
+    std::shared_ptr<ThreadPool> pool = threadPool();
+    if (__labelsStale)
+    {
+        absorb();
+    }
+    prepareAlgorithm();
+
+    if (kmin < 1 || kmax < kmin)
+    {
+        return std::vector<RunStats>();
+    }
 
-        int cindex = 0;
-        int cindex2 = 0;
+    unsigned int count = kmax - kmin + 1;
+    if (threads == 0)
+    {
+        threads = pool->getThreads();
+    }
+    threads = std::min(threads, count);
 
-        while (cindex < k)
+    // Each task takes a contiguous block of k values: the first one starts
+    // from seeded rows, the others warm-start from the block's previous k
+    std::vector<RunStats> results(count);
+    auto block = [&](unsigned int first, unsigned int last) {
+        RunState state;
+        for (unsigned int b = first; b < last; b++)
         {
-            while (cindex2 < k)
+            int clusters = kmin + b;
+            if (b == first)
             {
-                double sum = interClusterEdges(clusterarray[cindex], clusterarray[cindex2]);
-                pOut += sum;
-                cindex2++;
+                state.centroids = seedCentroids(seed + clusters, clusters);
+                state.labels.assign(getRows(), 0);
             }
-            cindex++;
-            cindex2 = i + 1;
+            else
+            {
+                splitFarthest(state);
+            }
+            state.stats = RunStats();
+            state.stats.seed = seed + clusters;
+
+            lloyd(state);
+            results[b] = state.stats;
         }
-    if(dIn == 0 || pIn == 0 || dOut == 0 || pOut == 0)
+    };
+
+    pool->parallelFor(0, threads, 1, [&](unsigned int, unsigned int t, unsigned int) {
+        block(t * count / threads, (t + 1) * count / threads);
+    });
+
+    return results;
+}
+
+void KMeans::splitFarthest(RunState &state) const
+{
+    // The point worst served by the current centroids seeds the new cluster
+    const SparseStore *sparse = isEuclidean() ? __sparse.get() : nullptr;
+    std::vector<double> buffer;
+    std::vector<double> norms;
+    for (unsigned int i = 0; sparse && i < state.centroids.size(); i += pointdemensions)
     {
-        return 0;
+        norms.push_back(std::inner_product(&state.centroids[i], &state.centroids[i] + pointdemensions,
+                                           &state.centroids[i], 0.0));
     }
-    else
+
+    unsigned int farthest = 0;
+    double worst = -1;
+    for (unsigned int j = 0; j < state.labels.size(); j++)
     {
-        int computedscore = (dIn / pIn) / (dOut / pOut);
+        const double *centroid = &state.centroids[state.labels[j] * pointdemensions];
+        double d = sparse ? sparse->distanceSquared(j, centroid, norms[state.labels[j]])
+                          : __distance(rowData(j, buffer), centroid, pointdemensions);
+        if (d > worst)
+        {
+            worst = d;
+            farthest = j;
+        }
+    }
 
-        return computedscore;
+    std::vector<double> added(pointdemensions, std::numeric_limits<double>::max());
+    if (getRows() > 0)
+    {
+        copyCoords(added.data(), rowData(farthest, buffer), pointdemensions);
     }
+    state.centroids.insert(state.centroids.end(), added.begin(), added.end());
 }
 
 
 std::ostream &operator<<(std::ostream &os, const KMeans &kmeans)
 {
+    kmeans.materialize();
+
     ofstream output("results.txt");
         for (int i = 0; i < kmeans.k; i++)
         {
@@ -155,11 +1277,233 @@ std::ostream &operator<<(std::ostream &os, const KMeans &kmeans)
     return os;
 }
 
+unsigned int KMeans::generateDatasetId()
+{
+    // Dataset ids key the membership bitmaps, so they stay process-wide
+    static std::atomic<unsigned int> tempid(1);
+    return tempid.fetch_add(1, std::memory_order_relaxed);
+}
+
+void KMeans::absorb()
+{
+    // The rows of a sparse-only KMeans are not in any cluster, so only the
+    // centroids are read back
+    if (__sparseOnly)
+    {
+        __datasetSize = __sparse->getSize();
+        __materializedLabels = __labels;
+    }
+    else
+    {
+        unsigned int n = 0;
+        for (int i = 0; i < k; i++)
+        {
+            n += clusterarray[i].getSize();
+        }
+
+        // Keep the existing rows if every point is still where its index says;
+        // otherwise renumber the points in cluster order under a new dataset id
+        bool stable = (n == __points.size());
+        __labels.assign(__points.size(), -1);
+        for (int i = 0; stable && i < k; i++)
+        {
+            for (LNodePtr current = clusterarray[i].getheadpointer(); current != nullptr; current = current->next)
+            {
+                const Point &point = *current->p;
+                unsigned int row = point.getIndex();
+
+                if (point.getDataset() != __dataset || point.getIndex() < 0 || row >= n ||
+                    __points[row] != current->p || __labels[row] != -1)
+                {
+                    stable = false;
+                    break;
+                }
+                __labels[row] = i;
+            }
+        }
+
+        __datasetSize = n;
+        if (!stable)
+        {
+            __dataset = generateDatasetId();
+            __points.clear();
+            __labels.clear();
+            for (int i = 0; i < k; i++)
+            {
+                for (LNodePtr current = clusterarray[i].getheadpointer(); current != nullptr; current = current->next)
+                {
+                    current->p->setIndex(__dataset, __points.size());
+                    __points.push_back(current->p);
+                    __labels.push_back(i);
+                }
+            }
+
+            // Bitmaps built against the old numbering are meaningless now
+            if (k > 0 && clusterarray[0].hasMembershipIndex())
+            {
+                enableMembershipIndex();
+            }
+        }
+        __materializedLabels = __labels;
+
+        // The rows are written at the next run, see placeStore()
+        __store = PointStore(pointdemensions, __precision);
+        __rows.clear();
+        __storePlaced = false;
+        __tree.reset();
+        __quantizer.reset();
+        __sparse.reset();
+    }
+
+    __centroidValues.assign(k * pointdemensions, 0.0);
+    __centroidIndex.reset();
+    for (int i = 0; i < k; i++)
+    {
+        const Point &centroid = clusterarray[i].getCentroid();
+        if (centroid.getDims() == static_cast<int>(pointdemensions))
+        {
+            copyCoords(&__centroidValues[i * pointdemensions], centroid.data(), pointdemensions);
+        }
+    }
+
+    __labelsStale = false;
+    __clustersStale = false;
+}
+
+void KMeans::placeStore()
+{
+    std::shared_ptr<ThreadPool> pool = threadPool();
+    unsigned int n = __points.size();
+    bool copy = (__precision == SINGLE_PRECISION) || pool->isPinned();
+
+    // A fresh buffer, so no page is left where an earlier pool touched it;
+    // each row is first written by the worker that assigns it in lloyd()
+    __store = PointStore(pointdemensions, __precision);
+    __rows.resize(n);
+    if (copy)
+    {
+        __store.resize(n);
+    }
+    pool->parallelFor(0, n, STOP_CHECK_ROWS, [this, copy](unsigned int, unsigned int first, unsigned int last) {
+        for (unsigned int j = first; j < last; j++)
+        {
+            if (copy)
+            {
+                __store.setRow(j, __points[j]->data());
+            }
+            __rows[j] = (copy && __precision == DOUBLE_PRECISION) ? __store.doubleRow(j) : __points[j]->data();
+        }
+    }, true);
+
+    __storePlaced = true;
+}
+
+void KMeans::materialize() const
+{
+    if (!__clustersStale)
+    {
+        return;
+    }
+
+    // Rows of a sparse-only KMeans are not Points, so there is nothing to move
+    Cluster::MoveBatch moves;
+    for (unsigned int j = 0; !__sparseOnly && j < __labels.size(); j++)
+    {
+        if (__labels[j] != __materializedLabels[j])
+        {
+            moves.add(__points[j], &clusterarray[__materializedLabels[j]], &clusterarray[__labels[j]]);
+        }
+    }
+    moves.perform();
+
+    for (int i = 0; i < k; i++)
+    {
+        Point centroid(pointdemensions);
+        copyCoords(centroid.data(), &__centroidValues[i * pointdemensions], pointdemensions);
+        clusterarray[i].setCentroid(centroid);
+    }
+
+    __materializedLabels = __labels;
+    __clustersStale = false;
+}
+
+const std::vector<int> &KMeans::getLabels()
+{
+    if (__labelsStale)
+    {
+        absorb();
+    }
+
+    return __labels;
+}
+
+int KMeans::clusterOf(const Point &point)
+{
+    if (__labelsStale)
+    {
+        absorb();
+    }
+
+    if (point.getDataset() != __dataset || point.getIndex() < 0 ||
+        static_cast<unsigned int>(point.getIndex()) >= __points.size())
+    {
+        return -1;
+    }
+
+    return __labels[point.getIndex()];
+}
+
+int KMeans::predict(const Point &point)
+{
+    if (__labelsStale)
+    {
+        absorb();
+    }
+
+    if (k <= 0 || point.getDims() != static_cast<int>(pointdemensions))
+    {
+        return -1;
+    }
+
+    // The index prunes with Euclidean distances
+    if (!isEuclidean())
+    {
+        double distance;
+        return metricLoops<double>(__metric, pointdemensions).nearest(point.data(), __centroidValues.data(), k,
+                                                                      pointdemensions, distance);
+    }
+
+    if (!__centroidIndex)
+    {
+        __centroidIndex = std::make_shared<CentroidIndex>(pointdemensions);
+        __centroidIndex->rebuild(__centroidValues.data(), k, *threadPool());
+    }
+
+    double distance;
+    return __centroidIndex->nearest(point.data(), 0, distance);
+}
+
+void KMeans::enableMembershipIndex()
+{
+    materialize();
+
+    for (int i = 0; i < k; i++)
+    {
+        clusterarray[i].indexMembership(__dataset, __datasetSize);
+    }
+}
+
 Cluster& KMeans::operator[](unsigned int u)
 {
+    // The caller may edit the cluster, so the labels are re-read on next use
+    materialize();
+    __labelsStale = true;
+
     return clusterarray[u];
 }
 const Cluster& KMeans::operator[](unsigned int u) const
 {
+    materialize();
+
     return clusterarray[u];
 }
\ No newline at end of file
@@ -2,9 +2,22 @@
 #define KELLEN_CSCI2312_PA2_KMEANS_H
 #include "Point.h"
 #include "Cluster.h"
+#include "FixedPoint.h"
+#include "PointStore.h"
+#include "ThreadPool.h"
+#include "KdTree.h"
+#include "CentroidIndex.h"
+#include "ProductQuantizer.h"
+#include "RandomProjection.h"
+#include "SparseStore.h"
 #include <string>
 #include <vector>
 #include <fstream>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <future>
+#include <functional>
 //
 using namespace Clustering;
 class KMeans {
@@ -13,31 +26,51 @@ class KMeans {
 
 public:
 
-    KMeans(unsigned int pointdemensionsvalue, int kvalue, std::string file ) : k(kvalue), pointdemensions(pointdemensionsvalue), __iFileName(file), score(0), __initCentroids(new Point *[k])
+    // localIds numbers this KMeans' clusters 1..k from its own IdSpace
+    // instead of the process-wide cluster id sequence
+    KMeans(unsigned int pointdemensionsvalue, int kvalue, std::string file, Precision precision = DOUBLE_PRECISION,
+           bool localIds = false) :
+            k(kvalue), pointdemensions(pointdemensionsvalue), __iFileName(file), score(0), __initCentroids(new Point *[k]),
+            __distance(selectDistanceKernel<double>(pointdemensionsvalue)),
+            __precision(precision), __store(pointdemensionsvalue, precision),
+            __labelsStale(false), __clustersStale(false)
     {
-        scorediff = SCORE_DIFF_THRESHOLD + 1;
-
         clusterarray.reserve(k);
         for (int i = 0; i < k; i++)
         {
-            clusterarray.emplace_back(pointdemensions);
+            if (localIds)
+                clusterarray.emplace_back(pointdemensions, __ids);
+            else
+                clusterarray.emplace_back(pointdemensions);
         }
 
         if (__iFileName != "") {
             std::ifstream csv(__iFileName);
             if (csv.is_open()) {    // TODO exception on failure
-                csv >> clusterarray[0];
+                if (!loadSparse(csv))
+                    csv >> clusterarray[0];
                 csv.close();
             }
         }
+        __dataset = 0;
+        __datasetSize = 0;
+
         if(clusterarray[0].getSize() > 0)
         {
-            clusterarray[0].pickPoints(k, __initCentroids);
+            std::vector<std::unique_ptr<Point> > placeholders = clusterarray[0].pickPoints(k, __initCentroids);
 
             for (int i = 0; i < k; i++) {
                 clusterarray[i].setCentroid(*__initCentroids[i]);
             }
+
+            // The centroids pickPoints could not take from the cluster go
+            // with `placeholders`
+            for (int i = clusterarray[0].getSize(); i < k; i++) {
+                __initCentroids[i] = nullptr;
+            }
         }
+
+        absorb();
     };
 
     ~KMeans()
@@ -47,19 +80,286 @@ public:
 
     unsigned int pointdemensions;
     int k;
-    static constexpr double SCORE_DIFF_THRESHOLD = 20;
     double betacv;
     std::string __iFileName;
-    double scorediff;
-    std::vector<Cluster> clusterarray;
-    int score;
+    Cluster::IdSpace __ids; // used when constructed with localIds
+    mutable std::vector<Cluster> clusterarray; // views, see materialize()
+    double score;
     Point **__initCentroids;
+    // Kernel of __metric, specialized for pointdemensions, for the odd
+    // distance outside the per-metric loops a run picks in KMeans.cpp
+    DistanceKernel __distance;
+
+    // Metric of the assignment step, prediction and scores. FILTERING,
+    // INDEXED, QUANTIZED and the sparse store rely on Euclidean geometry;
+    // with any other metric runs use LLOYD on the dense rows. With COSINE
+    // the points must be unit length, and centroids are rescaled to unit
+    // length after every update (spherical KMeans).
+    Metric __metric = EUCLIDEAN;
+    void setMetric(Metric metric);
+    Metric getMetric() const { return __metric; }
+    bool isEuclidean() const { return __metric == EUCLIDEAN || __metric == SQUARED_EUCLIDEAN; }
+
+    // Compute precision of the assignment step. Every pass over the rows
+    // (assignment, update, score, inertia) reads the same placed rows, in
+    // single precision the float ones widened; centroid sums and the
+    // clustering score are always accumulated in double. n points of d
+    // dimensions hold 8nd bytes of coordinates in their Points. In double
+    // precision runs read those in place, adding only a pointer per row.
+    // Single precision adds a 4nd-byte float copy (12nd in all), which
+    // halves what the assignment streams. Whether that is faster depends on
+    // the build: on 40000 points of 16 dimensions with k = 256 it took
+    // 2.1 s against 1.3 s for double at -O2, but 0.72 s against 0.96 s at
+    // -O3 -march=native, where the float loops vectorize.
+    Precision __precision;
+    // Copy of all points, one row per point, read-only during runs. Only
+    // kept in single precision or for a pinned pool (an 8nd-byte double
+    // copy then): its rows are first written by the pool that will run the
+    // assignment, at the first run after absorb() or setThreadPool(), so
+    // each page lands on the NUMA node of the worker that later reads it.
+    PointStore __store;
+    std::vector<const double *> __rows; // row j in double: in __store if it has them, else __points[j]
+    bool __storePlaced = false;
+    void placeStore();
+
+    // Authoritative clustering: row j of __store is __points[j] and belongs
+    // to cluster __labels[j]; centroid i is __centroidValues[i*dims..].
+    // clusterarray only mirrors this, and is brought up to date lazily.
+    std::vector<PointPtr> __points;
+    std::vector<int> __labels;
+    std::vector<double> __centroidValues;
+    mutable std::vector<int> __materializedLabels; // labels clusterarray reflects
+    bool __labelsStale;           // clusterarray was handed out mutably
+    mutable bool __clustersStale; // labels moved on since the last materialize
+
+    // Timing and outcome of one Lloyd run
+    struct RunStats {
+        unsigned int seed = 0;
+        int clusters = 0;
+        unsigned int iterations = 0;
+        unsigned int reassigned = 0; // in the last iteration
+        double shift = 0;            // largest centroid move in the last iteration
+        double seconds = 0;
+        double betacv = 0; // final score, NaN if a deadline cut the run short
+        bool degenerate = false; // one nonempty cluster or only singletons, BetaCV is undefined
+        bool converged = false; // false when stopped by a limit instead
+        bool cancelled = false;
+        bool expired = false;   // interrupted before the run, score included, was done
+        double inertia = 0; // sum of squared distances to the centroids
+        double recall = 1;  // QUANTIZED: share of rows assigned as LLOYD would
+    };
+
+    // Reported after every iteration of a run
+    struct Progress {
+        unsigned int iteration;
+        unsigned int reassigned;
+        double betacv;  // NaN unless Convergence::scoreEveryIteration
+        double inertia; // against the centroids the points were assigned to
+        double seconds;
+    };
+    typedef std::function<void(const Progress &)> ProgressCallback;
+
+    // Everything one run owns; runs only share the const point rows
+    struct RunState {
+        std::vector<int> labels;
+        std::vector<double> centroids;
+        RunStats stats;
+        bool hasDeadline = false;
+        std::chrono::steady_clock::time_point deadline;
+        const std::atomic<bool> *cancel = nullptr;
+        ProgressCallback progress;
+
+        // Deadline or cancellation, whichever comes first
+        bool interrupted() const
+        {
+            return (cancel != nullptr && cancel->load(std::memory_order_relaxed)) ||
+                   (hasDeadline && std::chrono::steady_clock::now() >= deadline);
+        }
+    };
+
+    // A run stops as soon as any one criterion is met. All of them come from
+    // the assignment and update steps; the quadratic BetaCV score is only
+    // computed once per run unless scoreEveryIteration is set.
+    struct Convergence {
+        unsigned int maxReassigned = 0;  // points that changed cluster
+        double maxShift = 0;             // largest centroid move (distance)
+        double minInertiaChange = 0;     // relative change between iterations
+        unsigned int maxIterations = 100;
+        double maxSeconds = 0;           // wall clock per run, 0 for no limit
+        bool scoreEveryIteration = false;
+    };
+
+    Convergence __convergence;
+    void setConvergence(const Convergence &convergence) { __convergence = convergence; }
+    const Convergence &getConvergence() const { return __convergence; }
+
+    std::vector<RunStats> __runStats;
+    unsigned int __bestRun = 0;
+
+    // Rows per assignment task; deadline and cancellation are checked
+    // before each task
+    static constexpr unsigned int STOP_CHECK_ROWS = 1024;
+    // Pair-balanced chunks of the BetaCV score
+    static constexpr unsigned int SCORE_CHUNKS = 64;
+    // Most partial buffers the centroid sums are split over
+    static constexpr unsigned int REDUCE_PARTITIONS = 16;
 
-    double mindistance(Point &, Point );
+    // Assignment step of every run. FILTERING walks a kd-tree over the points
+    // and hands whole cells to a centroid once only one can be nearest; it
+    // pays off for low-dimensional data. INDEXED keeps a CentroidIndex and a
+    // per-point bound across iterations, and only searches (from the point's
+    // last cluster) where the bound fails. Its first iteration costs a LLOYD
+    // one plus an O(k^2 d) build, so it only pays off over many iterations:
+    // over 20 on 20000 points it won from k = 64..128 on, 3.5x at k = 4096,
+    // while 5 iterations roughly broke even (centroid_benchmark, Release).
+    // Both give LLOYD's labels.
+    // QUANTIZED is approximate: it ranks the centroids by product-quantized
+    // distance and only computes the exact distance to the best few.
+    enum Algorithm { LLOYD, FILTERING, INDEXED, QUANTIZED };
+    Algorithm __algorithm = LLOYD;
+    void setAlgorithm(Algorithm algorithm) { __algorithm = algorithm; }
+    Algorithm getAlgorithm() const { return __algorithm; }
+
+    // Settings of the QUANTIZED assignment step
+    struct Quantization {
+        unsigned int subspaces = 8;   // bytes per encoded point
+        unsigned int codewords = 256; // per subspace
+        unsigned int rerank = 4;      // centroids compared exactly per point
+        unsigned int iterations = 10; // codebook training
+        unsigned int seed = 0;
+    };
+
+    Quantization __quantization;
+    void setQuantization(const Quantization &quantization) { __quantization = quantization; __quantizer.reset(); }
+    const Quantization &getQuantization() const { return __quantization; }
+
+    // Built on the first FILTERING or QUANTIZED run and kept until absorb()
+    // reloads the points, so their cost is shared by all later iterations,
+    // runs and restarts
+    std::shared_ptr<const KdTree> __tree;
+    std::shared_ptr<const ProductQuantizer> __quantizer;
+    void prepareAlgorithm();
+    // QUANTIZED nearest centroid of a row, given the centroids' PQ tables
+    int rerankedNearest(unsigned int row, const double *centroids, int clusters, const std::vector<double> &tables,
+                        std::vector<std::pair<double, int> > &shortlist, std::vector<double> &buffer,
+                        double &distance) const;
+
+    // Mostly-zero data: the LLOYD assignment and update steps, the score
+    // and the inertia read the points from a SparseStore instead of the
+    // dense rows. Built with the kd-tree and the quantizer, see prepareAlgorithm().
+    bool __sparseRows = false;
+    std::shared_ptr<const SparseStore> __sparse;
+    void setSparse(bool sparse) { if (!__sparseOnly) { __sparseRows = sparse; if (!sparse) __sparse.reset(); } }
+    bool isSparse() const { return __sparseRows; }
+
+    // A file of index:value rows is read straight into __sparse and no Point
+    // is made for its rows, so the clusters stay empty and the clustering is
+    // read through getLabels(). Such a KMeans always runs LLOYD; metrics other
+    // than Euclidean expand one row at a time.
+    bool __sparseOnly = false;
+    bool loadSparse(std::istream &); // false, consuming nothing, for dense files
+    unsigned int getRows() const { return __sparseOnly ? __sparse->getSize() : __points.size(); }
+    // Coordinates of row j as the runs read them, once placeStore() has run;
+    // float rows and rows of a sparse-only KMeans are expanded into buffer
+    const double *rowData(unsigned int j, std::vector<double> &buffer) const;
+
+    // Optional preprocessing for run(): clusters a seeded sparse random
+    // projection of the points to `dims` dimensions with the same settings,
+    // then recomputes the centroids, score and inertia in the original
+    // space from the labels. 0 (or dims >= pointdemensions) turns it off.
+    unsigned int __projectionDims = 0;
+    unsigned int __projectionSeed = 0;
+    void setProjection(unsigned int dims, unsigned int seed = 0) { __projectionDims = dims; __projectionSeed = seed; }
+    unsigned int getProjectionDims() const { return __projectionDims; }
+    void runProjected(RunState &);
+
+    // Runs every parallel stage: the pool given to setThreadPool, otherwise
+    // whichever pool is shared when a stage starts. Stages hold the result
+    // until they finish, so a configureShared in between cannot free it.
+    ThreadPool *__pool = nullptr;
+    void setThreadPool(ThreadPool &pool) { __pool = &pool; __storePlaced = false; }
+    std::shared_ptr<ThreadPool> threadPool() const
+    {
+        return __pool ? std::shared_ptr<ThreadPool>(std::shared_ptr<ThreadPool>(), __pool) : ThreadPool::shared();
+    }
+
+    // Iterates assignment and update until __convergence is met
+    void lloyd(RunState &) const;
+    void runCurrent(RunState &);
+    void adopt(const RunState &);
+    std::vector<double> seedCentroids(unsigned int seed, int clusters) const;
+    void splitFarthest(RunState &) const; // adds a centroid, k-1 -> k warm start
+    // NaN if the run state given is interrupted before the score is done
+    double betaCV(const std::vector<int> &labels, int clusters, const RunState *state = nullptr) const;
+    static bool isDegenerate(const std::vector<int> &labels, int clusters);
+    double inertia(const std::vector<int> &labels, const std::vector<double> &centroids) const;
+
+    // Rebuilds the rows, labels and centroids from clusterarray
+    void absorb();
+    // Applies the label changes to clusterarray as one batch of moves
+    void materialize() const;
+
+    // Points are numbered by their row, 0..__datasetSize-1, within dataset __dataset
+    unsigned int __dataset;
+    unsigned int __datasetSize;
+    static unsigned int generateDatasetId();
+
+    // Gives every cluster a membership bitmap over the loaded points,
+    // making Cluster::contains and Cluster equality word operations
+    void enableMembershipIndex();
+
+    double mindistance(const Point &, const Point &);
     double computeClusteringScore();
     void run();
+    // Anytime mode: stops at the deadline, keeping the best labels and
+    // centroids found so far. Returns whether the run converged and was
+    // scored before the deadline.
+    bool run(std::chrono::steady_clock::time_point deadline);
+
+    // Handle to a run on another thread. cancel() asks the run to stop at
+    // its next check; it then keeps the best clustering so far, as with a
+    // deadline. Releasing the last handle waits for the run to finish.
+    class AsyncRun {
+        std::shared_future<RunStats> __result;
+        std::shared_ptr<std::atomic<bool> > __cancel;
+    public:
+        AsyncRun(const std::shared_future<RunStats> &result, const std::shared_ptr<std::atomic<bool> > &cancel) :
+                __result(result), __cancel(cancel) {};
+
+        void cancel() { __cancel->store(true, std::memory_order_relaxed); }
+        bool ready() const { return __result.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+        void wait() const { __result.wait(); }
+        const RunStats &get() const { return __result.get(); }
+    };
+
+    // Same as run(), on a new thread. The KMeans must not be used until the
+    // run finishes; the callback is invoked on the run's thread.
+    AsyncRun runAsync(ProgressCallback progress = ProgressCallback());
+
+    // Runs `restarts` independently seeded clusterings, at most `threads` at a
+    // time (0: the pool's thread count), and keeps the best one by betterRun
+    void runRestarts(unsigned int restarts, unsigned int seed = 0, unsigned int threads = 0);
+    // Lower BetaCV wins; degenerate and unscored (NaN) runs rank after every
+    // scored one and are compared by inertia among themselves
+    static bool betterRun(const RunStats &, const RunStats &);
+    const std::vector<RunStats> &getRunStats() const { return __runStats; } // also set by run()
+    unsigned int getBestRun() const { return __bestRun; }
+
+    // Clusters the loaded points for every k in [kmin, kmax] in parallel and
+    // reports score and inertia per k; this object's own clustering is kept
+    std::vector<RunStats> sweep(int kmin, int kmax, unsigned int seed = 0, unsigned int threads = 0);
     double getScore() const { return score; }
 
+    // Cluster index of every loaded point, by row (the point's getIndex())
+    const std::vector<int> &getLabels();
+    // Cluster index of a point in O(1), -1 if it is not part of this run
+    int clusterOf(const Point &);
+    // Cluster index whose centroid is closest to any point of matching
+    // dimension, -1 otherwise; queries share one CentroidIndex
+    int predict(const Point &);
+    std::shared_ptr<CentroidIndex> __centroidIndex; // over __centroidValues
+    Precision getPrecision() const { return __precision; }
+
     friend std::ostream &operator<<(std::ostream &os, const KMeans &kmeans);\
 
     Cluster &operator[](unsigned int u);
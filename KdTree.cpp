@@ -0,0 +1,224 @@
+#include "KdTree.h"
+#include <algorithm>
+#include <limits>
+
+using namespace Clustering;
+
+namespace Clustering {
+
+    constexpr unsigned int KdTree::LEAF_SIZE;
+
+    KdTree::KdTree(const std::vector<PointPtr> &points, unsigned int dims) :
+            __dims(dims), __distance(selectDistanceKernel<double>(dims))
+    {
+        __order.resize(points.size());
+        __coords.resize(points.size() * dims);
+        for (unsigned int j = 0; j < points.size(); j++)
+        {
+            __order[j] = j;
+            copyCoords(&__coords[j * dims], points[j]->data(), dims);
+        }
+
+        if (!points.empty())
+        {
+            build(0, points.size());
+        }
+    }
+
+    int KdTree::build(unsigned int begin, unsigned int end)
+    {
+        int index = __nodes.size();
+        __nodes.push_back(Node());
+        __low.resize(__low.size() + __dims, std::numeric_limits<double>::max());
+        __high.resize(__high.size() + __dims, std::numeric_limits<double>::lowest());
+        __sums.resize(__sums.size() + __dims, 0.0);
+
+        double sumSquares = 0;
+        for (unsigned int j = begin; j < end; j++)
+        {
+            const double *row = &__coords[j * __dims];
+            for (unsigned int d = 0; d < __dims; d++)
+            {
+                __low[index * __dims + d] = std::min(__low[index * __dims + d], row[d]);
+                __high[index * __dims + d] = std::max(__high[index * __dims + d], row[d]);
+                sumSquares += row[d] * row[d];
+            }
+            addCoords(&__sums[index * __dims], row, __dims);
+        }
+
+        Node node;
+        node.begin = begin;
+        node.end = end;
+        node.left = node.right = -1;
+        node.sumSquares = sumSquares;
+
+        if (end - begin > LEAF_SIZE)
+        {
+            // Median split on the widest side of the box
+            unsigned int split = 0;
+            for (unsigned int d = 1; d < __dims; d++)
+            {
+                if (__high[index * __dims + d] - __low[index * __dims + d] >
+                    __high[index * __dims + split] - __low[index * __dims + split])
+                {
+                    split = d;
+                }
+            }
+
+            unsigned int middle = begin + (end - begin) / 2;
+            std::vector<unsigned int> slots(end - begin);
+            for (unsigned int j = begin; j < end; j++)
+            {
+                slots[j - begin] = j;
+            }
+            std::nth_element(slots.begin(), slots.begin() + (middle - begin), slots.end(),
+                             [this, split](unsigned int lhs, unsigned int rhs) {
+                                 return __coords[lhs * __dims + split] < __coords[rhs * __dims + split];
+                             });
+
+            // Apply the permutation to the rows and their coordinates
+            std::vector<unsigned int> order(end - begin);
+            std::vector<double> coords((end - begin) * __dims);
+            for (unsigned int j = 0; j < slots.size(); j++)
+            {
+                order[j] = __order[slots[j]];
+                copyCoords(&coords[j * __dims], &__coords[slots[j] * __dims], __dims);
+            }
+            std::copy(order.begin(), order.end(), __order.begin() + begin);
+            std::copy(coords.begin(), coords.end(), __coords.begin() + begin * __dims);
+
+            node.left = build(begin, middle);
+            node.right = build(middle, end);
+        }
+
+        __nodes[index] = node;
+        return index;
+    }
+
+    void KdTree::filter(const double *centroids, unsigned int k, std::vector<int> &labels,
+                        double *sums, unsigned int *counts, unsigned int &reassigned, double &inertia) const
+    {
+        if (__nodes.empty() || k == 0)
+        {
+            return;
+        }
+
+        std::vector<int> candidates(k);
+        for (unsigned int i = 0; i < k; i++)
+        {
+            candidates[i] = i;
+        }
+
+        filter(0, candidates, centroids, labels, sums, counts, reassigned, inertia);
+    }
+
+    void KdTree::filter(int index, std::vector<int> &candidates, const double *centroids,
+                        std::vector<int> &labels, double *sums, unsigned int *counts,
+                        unsigned int &reassigned, double &inertia) const
+    {
+        const Node &node = __nodes[index];
+        const double *low = &__low[index * __dims];
+        const double *high = &__high[index * __dims];
+
+        if (node.left < 0)
+        {
+            // Leaf: nearest candidate per point, ties to the lowest index
+            // exactly as in the plain assignment step
+            for (unsigned int j = node.begin; j < node.end; j++)
+            {
+                const double *row = &__coords[j * __dims];
+                int best = candidates[0];
+                double bestDistance = __distance(row, centroids + best * __dims, __dims);
+                for (unsigned int c = 1; c < candidates.size(); c++)
+                {
+                    double d = __distance(row, centroids + candidates[c] * __dims, __dims);
+                    if (d < bestDistance || (d == bestDistance && candidates[c] < best))
+                    {
+                        bestDistance = d;
+                        best = candidates[c];
+                    }
+                }
+
+                if (labels[__order[j]] != best)
+                {
+                    labels[__order[j]] = best;
+                    reassigned++;
+                }
+                addCoords(sums + best * __dims, row, __dims);
+                counts[best]++;
+                inertia += bestDistance;
+            }
+            return;
+        }
+
+        // The candidate closest to the middle of the cell
+        std::vector<double> middle(__dims);
+        for (unsigned int d = 0; d < __dims; d++)
+        {
+            middle[d] = (low[d] + high[d]) / 2;
+        }
+        int closest = candidates[0];
+        double closestDistance = __distance(middle.data(), centroids + closest * __dims, __dims);
+        for (unsigned int c = 1; c < candidates.size(); c++)
+        {
+            double d = __distance(middle.data(), centroids + candidates[c] * __dims, __dims);
+            if (d < closestDistance)
+            {
+                closestDistance = d;
+                closest = candidates[c];
+            }
+        }
+
+        // Drop every candidate that is strictly farther than `closest` even
+        // at the corner of the cell that favours it most
+        std::vector<int> kept;
+        std::vector<double> corner(__dims);
+        const double *best = centroids + closest * __dims;
+        for (unsigned int c = 0; c < candidates.size(); c++)
+        {
+            const double *z = centroids + candidates[c] * __dims;
+            if (candidates[c] != closest)
+            {
+                for (unsigned int d = 0; d < __dims; d++)
+                {
+                    corner[d] = (z[d] > best[d]) ? high[d] : low[d];
+                }
+                if (__distance(corner.data(), z, __dims) > __distance(corner.data(), best, __dims))
+                {
+                    continue;
+                }
+            }
+            kept.push_back(candidates[c]);
+        }
+
+        if (kept.size() == 1)
+        {
+            // Whole cell to one centroid: |x - c|^2 summed from the node totals
+            const double *sum = &__sums[index * __dims];
+            double dot = 0, norm = 0;
+            for (unsigned int d = 0; d < __dims; d++)
+            {
+                dot += best[d] * sum[d];
+                norm += best[d] * best[d];
+            }
+            unsigned int count = node.end - node.begin;
+
+            for (unsigned int j = node.begin; j < node.end; j++)
+            {
+                if (labels[__order[j]] != closest)
+                {
+                    labels[__order[j]] = closest;
+                    reassigned++;
+                }
+            }
+            addCoords(sums + closest * __dims, sum, __dims);
+            counts[closest] += count;
+            inertia += std::max(0.0, node.sumSquares - 2 * dot + count * norm);
+            return;
+        }
+
+        filter(node.left, kept, centroids, labels, sums, counts, reassigned, inertia);
+        filter(node.right, kept, centroids, labels, sums, counts, reassigned, inertia);
+    }
+
+}
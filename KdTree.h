@@ -0,0 +1,53 @@
+// kd-tree over a fixed set of points for the filtering KMeans algorithm
+// (Kanungo et al.). Every node keeps its bounding box and the sum of its
+// points, so once a single centroid is left as a candidate for a node,
+// the whole subtree is assigned and summed without visiting its points.
+
+#ifndef CLUSTERING_KDTREE_H
+#define CLUSTERING_KDTREE_H
+
+#include "Cluster.h"
+#include "FixedPoint.h"
+#include <vector>
+
+namespace Clustering {
+
+    class KdTree {
+        struct Node {
+            unsigned int begin, end; // range of __order / __coords
+            int left, right;         // -1 for a leaf
+            double sumSquares;       // sum of |x|^2 over the node's points
+        };
+
+        unsigned int __dims;
+        std::vector<Node> __nodes;
+        std::vector<unsigned int> __order; // row of each point in tree order
+        std::vector<double> __coords;      // points in tree order
+        std::vector<double> __low, __high, __sums; // per node, dims each
+        DistanceKernel __distance;
+
+        int build(unsigned int begin, unsigned int end);
+        void filter(int node, std::vector<int> &candidates, const double *centroids,
+                    std::vector<int> &labels, double *sums, unsigned int *counts,
+                    unsigned int &reassigned, double &inertia) const;
+
+    public:
+        // Leaves hold at most this many points
+        static constexpr unsigned int LEAF_SIZE = 16;
+
+        // Indexes points[0..n); row j of the tree is points[j]
+        KdTree(const std::vector<PointPtr> &points, unsigned int dims);
+
+        unsigned int getSize() const { return __order.size(); }
+        unsigned int getNodes() const { return __nodes.size(); }
+
+        // One assignment step against k centroids: updates labels (by row),
+        // adds every cluster's coordinate sum and count to sums/counts,
+        // counts the changed labels and totals the squared distances
+        void filter(const double *centroids, unsigned int k, std::vector<int> &labels,
+                    double *sums, unsigned int *counts, unsigned int &reassigned, double &inertia) const;
+    };
+
+}
+
+#endif //CLUSTERING_KDTREE_H
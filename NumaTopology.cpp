@@ -0,0 +1,85 @@
+#include "NumaTopology.h"
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+
+using namespace Clustering;
+
+namespace Clustering {
+
+    NumaTopology NumaTopology::detect(const std::string &sysfs)
+    {
+        NumaTopology topology;
+
+        // Node ids can have gaps, so probe until a few in a row are missing
+        for (unsigned int node = 0, missing = 0; missing < 8; node++)
+        {
+            std::ifstream cpulist(sysfs + "/node" + std::to_string(node) + "/cpulist");
+            if (!cpulist.is_open())
+            {
+                missing++;
+                continue;
+            }
+            missing = 0;
+
+            std::string line;
+            std::getline(cpulist, line);
+            std::vector<int> cpus = parseCpuList(line);
+            if (!cpus.empty()) // memory-only nodes have no CPUs
+            {
+                topology.__nodeCpus.push_back(cpus);
+            }
+        }
+
+        if (topology.__nodeCpus.empty())
+        {
+            std::vector<int> cpus;
+            for (unsigned int cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++)
+            {
+                cpus.push_back(cpu);
+            }
+            topology.__nodeCpus.push_back(cpus);
+        }
+
+        return topology;
+    }
+
+    std::vector<int> NumaTopology::cpusInNodeOrder() const
+    {
+        std::vector<int> cpus;
+        for (unsigned int node = 0; node < __nodeCpus.size(); node++)
+        {
+            cpus.insert(cpus.end(), __nodeCpus[node].begin(), __nodeCpus[node].end());
+        }
+        return cpus;
+    }
+
+    std::vector<int> NumaTopology::parseCpuList(const std::string &list)
+    {
+        std::vector<int> cpus;
+        std::stringstream ranges(list);
+        std::string range;
+
+        while (std::getline(ranges, range, ','))
+        {
+            std::stringstream bounds(range);
+            int first, last;
+            char dash;
+
+            if (!(bounds >> first))
+            {
+                continue;
+            }
+            last = (bounds >> dash >> last) ? last : first;
+
+            for (int cpu = first; cpu <= last; cpu++)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+
+        return cpus;
+    }
+
+}
@@ -0,0 +1,32 @@
+// CPUs of each NUMA node, read from sysfs (/sys/devices/system/node).
+// Hosts without that information are treated as a single node holding
+// every CPU, so callers never need a special case.
+
+#ifndef CLUSTERING_NUMATOPOLOGY_H
+#define CLUSTERING_NUMATOPOLOGY_H
+
+#include <vector>
+#include <string>
+
+namespace Clustering {
+
+    class NumaTopology {
+        std::vector<std::vector<int> > __nodeCpus;
+
+    public:
+        static NumaTopology detect(const std::string &sysfs = "/sys/devices/system/node");
+
+        unsigned int getNodes() const { return __nodeCpus.size(); }
+        const std::vector<int> &getCpus(unsigned int node) const { return __nodeCpus[node]; }
+
+        // Every CPU, node by node. Pinning pool workers in this order gives
+        // each node a contiguous range of workers, and so of rows.
+        std::vector<int> cpusInNodeOrder() const;
+
+        // Parses a sysfs cpulist such as "0-3,8,10-11"
+        static std::vector<int> parseCpuList(const std::string &);
+    };
+
+}
+
+#endif //CLUSTERING_NUMATOPOLOGY_H
@@ -1,15 +1,19 @@
 #include "Point.h"
+#include "FixedPoint.h"
 #include <cmath>
 #include <cassert>
 #include <iomanip>
+#include <utility>
+#include <algorithm>
+#include "ThreadPool.h"
 
 using namespace std;
 using namespace Clustering;
 
 //
 // Default constructor
-// Initializes the point to (0.0, 0.0, 0.0)
-Point::Point() {
+// Initializes an empty point with no dimensions
+Point::Point() : dim(0), coords(__inlineCoords) {
 
 }
 
@@ -17,9 +21,7 @@ Point::Point() {
 
 Point::Point(int numofdemensions)
 {
-
-       dim = numofdemensions;
-      coords = new double[dim];
+    allocate(numofdemensions);
     for (int i = 0; i < dim; i++)
     {
         coords[i] = 0;
@@ -28,8 +30,7 @@ Point::Point(int numofdemensions)
 
 Point::Point(int numofdemensions, double *array)
 {
-    dim = numofdemensions;
-    coords = new double[dim];
+    allocate(numofdemensions);
 
     for (int i = 0; i < dim; i++)
     {
@@ -40,19 +41,50 @@ Point::Point(int numofdemensions, double *array)
 
 Point::Point(const Point &temp)
     {
-        dim = temp.dim;
-        coords = new double[dim];
-        for (int i = 0; i < dim; i++)
-        {
-            coords[i] = temp.coords[i];
-        }
+        allocate(temp.dim);
+        copyCoords(coords, temp.coords, dim);
+    }
+
+// Move constructor
+// Takes over heap coordinates, leaving temp as an empty point.
+// Inline coordinates cannot be stolen and are copied instead.
+Point::Point(Point &&temp) noexcept
+{
+    if (temp.isInline())
+    {
+        allocate(temp.dim);
+        copyCoords(coords, temp.coords, dim);
+        return;
     }
 
+    dim = temp.dim;
+    coords = temp.coords;
+    temp.dim = 0;
+    temp.coords = temp.__inlineCoords;
+}
+
 // Destructor
 //Releases the memory occupied by the coords pointer
 Point::~Point()
 {
-  delete[] coords;
+    release();
+}
+
+// Points up to INLINE_DIMS use the in-object buffer, larger ones the heap
+void Point::allocate(int numofdemensions)
+{
+    dim = numofdemensions;
+    coords = (dim <= INLINE_DIMS) ? __inlineCoords : new double[dim];
+}
+
+void Point::release()
+{
+    if (!isInline())
+    {
+        delete[] coords;
+    }
+    dim = 0;
+    coords = __inlineCoords;
 }
 
 double Point::getValue(int index) const
@@ -72,132 +104,88 @@ void Point::setValue(int index, double value)
      if(this == &rhs)
          return *this;
 
-     dim = rhs.dim;
-
-     for(int i = 0; i < dim; i++)
+     if(dim != rhs.dim)
      {
+         release();
+         allocate(rhs.dim);
+     }
+
+     copyCoords(coords, rhs.coords, dim);
+
+     return *this;
+ }
+
+ Point& Point::operator=(Point &&rhs) noexcept
+ {
+     if(this == &rhs)
+         return *this;
 
-         coords[i] = rhs.coords[i];
+     if(rhs.isInline())
+     {
+         return *this = rhs;
      }
 
+     release();
+     dim = rhs.dim;
+     coords = rhs.coords;
+     rhs.dim = 0;
+     rhs.coords = rhs.__inlineCoords;
+
+     return *this;
+ }
+
+ // this += factor * rhs, in place
+ Point& Point::addScaled(const Point &rhs, double factor)
+ {
+     addScaledCoords(coords, rhs.coords, factor, dim);
+
      return *this;
  }
 
 namespace Clustering {
 
-    bool operator==(const Point &lhs, const Point &rhs) {
-        bool result;
-
-        for (int i = 0; i < lhs.getDims(); i++) {
-            if (lhs.coords[i] == rhs.coords[i])
-                result = true;
-            else {
-                result = false;
-                return result;
-            }
-        }
+    // Lexicographic three-way comparison: the first differing coordinate
+    // decides, a point that is a prefix of the other is the smaller one
+    int compare(const Point &lhs, const Point &rhs)
+    {
+        int dims = (lhs.dim < rhs.dim) ? lhs.dim : rhs.dim;
+        int result = compareCoords(lhs.coords, rhs.coords, dims);
+
+        if (result == 0 && lhs.dim != rhs.dim)
+            result = (lhs.dim < rhs.dim) ? -1 : 1;
 
         return result;
     }
 
+    bool operator==(const Point &lhs, const Point &rhs) {
+        return lhs.dim == rhs.dim &&
+               firstDifference(lhs.coords, rhs.coords, lhs.dim) == static_cast<unsigned int>(lhs.dim);
+    }
 
-    bool operator!=(const Point &lhs, const Point &rhs) {
-        bool result;
-
-        for (int i = 0; i < lhs.getDims(); i++) {
-            if (lhs.coords[i] == rhs.coords[i])
-                result = false;
-            else {
-                result = true;
-                return result;
-            }
-        }
 
-        return result;
+    bool operator!=(const Point &lhs, const Point &rhs) {
+        return !(lhs == rhs);
     }
 
     bool operator<(const Point &lhs, const Point &rhs) {
-        int index = 0;
-
-        for (int i = 0; i < lhs.getDims(); i++) {
-            if (lhs.coords[i] == rhs.coords[i])
-                index++;
-            else
-                break;
-        }
-
-        if (lhs.coords[index] < rhs.coords[index])
-            return true;
-        else
-            return false;
+        return compare(lhs, rhs) < 0;
     }
 
     bool operator>(const Point &lhs, const Point &rhs) {
-        int index = 0;
-
-        for (int i = 0; i < lhs.getDims(); i++) {
-            if (lhs.coords[i] == rhs.coords[i])
-                index++;
-            else
-                break;
-        }
-
-        if (lhs.coords[index] > rhs.coords[index])
-            return true;
-        else
-            return false;
+        return compare(lhs, rhs) > 0;
     }
 
     bool operator<=(const Point &lhs, const Point &rhs) {
-        int index = 0;
-        bool same;
-        for (int i = 0; i < lhs.getDims(); i++) {
-            if (lhs.coords[i] == rhs.coords[i]) {
-                index++;
-                same = true;
-            }
-            else
-                same = false;
-            break;
-        }
-        if (same == true)
-            return true;
-        else {
-            if (lhs.coords[index] < rhs.coords[index])
-                return true;
-            else
-                return false;
-        }
+        return compare(lhs, rhs) <= 0;
     }
 
     bool operator>=(const Point &lhs, const Point &rhs) {
-        int index = 0;
-        bool same;
-        for (int i = 0; i < lhs.getDims(); i++) {
-            if (lhs.coords[i] == rhs.coords[i]) {
-                index++;
-                same = true;
-            }
-            else
-                same = false;
-            break;
-        }
-        if (same == true)
-            return true;
-        else {
-            if (lhs.coords[index] > rhs.coords[index])
-                return true;
-            else
-                return false;
-        }
+        return compare(lhs, rhs) >= 0;
     }
 
     Point &operator+=(Point &lhs, const Point &rhs)
     {
-        for(int i = 0; i < lhs.dim; i++)
-        {
-            lhs.coords[i] += rhs.coords[i];
-        }
+        addCoords(lhs.coords, rhs.coords, lhs.dim);
 
         return lhs;
 
@@ -206,50 +194,53 @@ namespace Clustering {
 
     Point &operator-=(Point &lhs, const Point &rhs)
     {
-        for(int i = 0; i < lhs.dim; i++)
-        {
-            lhs.coords[i] -= rhs.coords[i];
-        }
+        subtractCoords(lhs.coords, rhs.coords, lhs.dim);
 
         return lhs;
 
     }
 
 
-    const Point operator+(const Point &lhs, const Point &rhs)
+    Point operator+(const Point &lhs, const Point &rhs)
     {
-        Point result(lhs.dim);
+        Point result(lhs);
 
-        for(int i = 0; i < lhs.dim; i++)
-        {
-           result.coords[i] = lhs.coords[i] + rhs.coords[i];
-        }
+        addCoords(result.coords, rhs.coords, lhs.dim);
 
         return result;
 
 
     }
 
-    const Point operator-(const Point &lhs, const Point &rhs)
+    // Reuses the temporary on the left, so a + b + c allocates once
+    Point operator+(Point &&lhs, const Point &rhs)
     {
-        Point result(lhs.dim);
+        addCoords(lhs.coords, rhs.coords, lhs.dim);
 
-        for(int i = 0; i < lhs.dim; i++)
-        {
-            result.coords[i] = lhs.coords[i] - rhs.coords[i];
-        }
+        return std::move(lhs);
+    }
+
+    Point operator-(const Point &lhs, const Point &rhs)
+    {
+        Point result(lhs);
+
+        subtractCoords(result.coords, rhs.coords, lhs.dim);
 
         return result;
 
 
     }
 
+    Point operator-(Point &&lhs, const Point &rhs)
+    {
+        subtractCoords(lhs.coords, rhs.coords, lhs.dim);
+
+        return std::move(lhs);
+    }
+
     Point &Point::operator*=(double number)
     {
-        for(int i = 0; i < dim; i++)
-        {
-            coords[i] *= number;
-        }
+        scaleCoords(coords, number, dim);
 
         return *this;
     }
@@ -258,39 +249,45 @@ namespace Clustering {
     {
         assert( number != 0);
 
-        for(int i = 0; i < dim; i++)
-        {
-            coords[i] /= number;
-        }
+        divideCoords(coords, number, dim);
 
+        return *this;
     }
 
-    const Point Point::operator*(double number) const
+    Point Point::operator*(double number) const &
     {
-        Point result(dim);
+        Point result(*this);
 
-        for(int i = 0; i < dim; i++)
-        {
-            result.coords[i] = coords[i] * number;
-        }
+        scaleCoords(result.coords, number, dim);
 
         return result;
 
     }
 
-    const Point Point::operator/(double number) const
+    Point Point::operator*(double number) &&
     {
-        Point result(dim);
+        scaleCoords(coords, number, dim);
 
-        for(int i = 0; i < dim; i++)
-        {
-            result.coords[i] = coords[i] / number;
-        }
+        return std::move(*this);
+    }
+
+    Point Point::operator/(double number) const &
+    {
+        Point result(*this);
+
+        divideCoords(result.coords, number, dim);
 
         return result;
 
     }
 
+    Point Point::operator/(double number) &&
+    {
+        divideCoords(coords, number, dim);
+
+        return std::move(*this);
+    }
+
     std::ostream &operator<<(std::ostream &output, const Point &point)
     {
 
@@ -336,18 +333,66 @@ namespace Clustering {
 
 
 
-double Point::distanceTo(Point &point1)
+double Point::distanceTo(const Point &point1) const
 {
     assert(dim == point1.dim);
-    double sum = 0;
-    double difference = 0;
-    for(int i = 0; i < dim; i++)
-    {
-        difference = (pow(coords[i] - point1.coords[i], 2));
-        sum += difference;
-    }
+
+    double sum = distanceSquared(coords, point1.coords, dim);
 
     sum = sqrt(sum);
 
   return sum;
-}
\ No newline at end of file
+}
+
+
+namespace Clustering {
+
+    std::vector<unsigned int> lexicographicOrder(const Point *const *points, unsigned int n, unsigned int threads)
+    {
+        // Below this many points per chunk a task costs more than it saves
+        const unsigned int MIN_CHUNK = 4096;
+
+        std::vector<unsigned int> order(n);
+        for (unsigned int i = 0; i < n; i++)
+        {
+            order[i] = i;
+        }
+
+        auto less = [points](unsigned int lhs, unsigned int rhs) {
+            return compare(*points[lhs], *points[rhs]) < 0;
+        };
+
+        std::shared_ptr<ThreadPool> shared = ThreadPool::shared();
+        ThreadPool &pool = *shared;
+        if (threads == 0)
+        {
+            threads = pool.getThreads();
+        }
+        threads = std::min(threads, std::max(1u, n / MIN_CHUNK));
+
+        std::vector<unsigned int> bounds;
+        for (unsigned int t = 0; t <= threads; t++)
+        {
+            bounds.push_back(static_cast<unsigned int>(static_cast<unsigned long long>(n) * t / threads));
+        }
+
+        pool.parallelFor(bounds, [&order, &less](unsigned int, unsigned int first, unsigned int last) {
+            std::stable_sort(order.begin() + first, order.begin() + last, less);
+        });
+
+        // Pairwise merge of the sorted chunks, the merges of a round in parallel
+        for (unsigned int width = 1; width < threads; width *= 2)
+        {
+            unsigned int merges = (threads - width + 2 * width - 1) / (2 * width);
+            pool.parallelFor(0, merges, 1, [&](unsigned int, unsigned int first, unsigned int) {
+                unsigned int t = first * 2 * width;
+                unsigned int last = std::min(t + 2 * width, threads);
+                std::inplace_merge(order.begin() + bounds[t], order.begin() + bounds[t + width],
+                                   order.begin() + bounds[last], less);
+            });
+        }
+
+        return order;
+    }
+
+}
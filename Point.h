@@ -1,29 +1,48 @@
 // An n-dimensional point class!
 // Coordinates are double-precision floating point.
+// Points of up to POINT_INLINE_DIMS dimensions keep their coordinates
+// inside the object, larger ones on the heap.
 
 #ifndef __point_h
 #define __point_h
 #include <iostream>
+#include <vector>
+#include "FixedPoint.h"
+
+#ifndef POINT_INLINE_DIMS
+#define POINT_INLINE_DIMS 8
+#endif
 
 
 namespace Clustering {
     class Point {
         int dim;
-        double *coords;
+        double *coords; // points at __inlineCoords or at a heap array
+        double __inlineCoords[POINT_INLINE_DIMS];
+        int __index = -1;           // row in its dataset, -1 if not part of one
+        unsigned int __dataset = 0; // dataset the row index belongs to
         static constexpr char POINT_VALUE_DELIM = ',';
 
+        void allocate(int);
+        void release();
+
     public:
         // Constructors
         Point();                      // default constructor
         Point(int);    // constructor with a given number of dimensions
         Point(int, double *);
         Point(const Point &);
+        Point(Point &&) noexcept;
 
         // Destructor
         ~Point();
 
         // Overloaded assignment, comparison, and arithmetic operators
         Point &operator=(const Point &rhs);
+        Point &operator=(Point &&rhs) noexcept;
+
+        // Lexicographic three-way comparison, backs all the operators below
+        friend int compare(const Point &, const Point &);
 
         friend bool operator==(const Point &, const Point &);
 
@@ -41,9 +60,11 @@ namespace Clustering {
 
         friend Point &operator-=(Point &, const Point &);
 
-        friend const Point operator+(const Point &, const Point &);
+        friend Point operator+(const Point &, const Point &);
+        friend Point operator+(Point &&, const Point &);
 
-        friend const Point operator-(const Point &, const Point &);
+        friend Point operator-(const Point &, const Point &);
+        friend Point operator-(Point &&, const Point &);
 
         double &operator[](int index) { return coords[index - 1]; }
 
@@ -56,9 +77,15 @@ namespace Clustering {
 
         Point &operator/=(double);
 
-        const Point operator*(double) const;
+        // Temporaries are scaled in place instead of copied
+        Point operator*(double) const &;
+        Point operator*(double) &&;
 
-        const Point operator/(double) const;
+        Point operator/(double) const &;
+        Point operator/(double) &&;
+
+        // Fused this += factor * rhs, no temporary
+        Point &addScaled(const Point &rhs, double factor);
 
         // Mutator methods
         double getValue(int) const;
@@ -67,10 +94,36 @@ namespace Clustering {
         // Accessor methods
         int getDims() const { return dim; }
 
-        double distanceTo(Point &point1);
+        static constexpr int INLINE_DIMS = POINT_INLINE_DIMS;
+        bool isInline() const { return coords == __inlineCoords; }
+
+        // Dataset row index. It names this object, so copies, moves and
+        // assignments never carry it over.
+        void setIndex(unsigned int dataset, int index) { __dataset = dataset; __index = index; }
+        int getIndex() const { return __index; }
+        unsigned int getDataset() const { return __dataset; }
+
+        // Raw coordinate access for the dimension-specialized kernels
+        double *data() { return coords; }
+        const double *data() const { return coords; }
+
+        double distanceTo(const Point &point1) const;
+
+        // Distance under a metric policy, e.g. distanceTo<Manhattan>(p)
+        template <typename Policy>
+        double distanceTo(const Point &point) const
+        {
+            return Policy::distance(metricKernel<Policy>(coords, point.coords, static_cast<unsigned int>(dim)));
+        }
 
 
     };
+
+    // Permutation that sorts points[0..n) lexicographically (stable).
+    // Up to `threads` chunks are sorted and merged as tasks on the shared
+    // ThreadPool; threads == 0 uses the pool's thread count.
+    std::vector<unsigned int> lexicographicOrder(const Point *const *points, unsigned int n,
+                                                 unsigned int threads = 0);
 }
 
 #endif // __point_h
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "PointStore.h"
+
+using namespace Clustering;
+
+namespace Clustering {
+
+    unsigned int PointStore::append(const Point &point)
+    {
+        return appendRow(point.data());
+    }
+
+    unsigned int PointStore::appendRow(const double *coords)
+    {
+        unsigned int index = getSize();
+
+        if (__precision == SINGLE_PRECISION)
+        {
+            for (unsigned int i = 0; i < __dims; i++)
+                __floats.push_back(static_cast<float>(coords[i]));
+        }
+        else
+        {
+            __doubles.insert(__doubles.end(), coords, coords + __dims);
+        }
+
+        return index;
+    }
+
+    void PointStore::setRow(unsigned int index, const double *coords)
+    {
+        if (__precision == SINGLE_PRECISION)
+        {
+            for (unsigned int i = 0; i < __dims; i++)
+                __floats[index * __dims + i] = static_cast<float>(coords[i]);
+        }
+        else
+        {
+            for (unsigned int i = 0; i < __dims; i++)
+                __doubles[index * __dims + i] = coords[i];
+        }
+    }
+
+    void PointStore::clear()
+    {
+        __doubles.clear();
+        __floats.clear();
+    }
+
+    void PointStore::reserve(unsigned int rows)
+    {
+        if (__precision == SINGLE_PRECISION)
+            __floats.reserve(rows * __dims);
+        else
+            __doubles.reserve(rows * __dims);
+    }
+
+    void PointStore::resize(unsigned int rows)
+    {
+        if (__precision == SINGLE_PRECISION)
+            __floats.resize(rows * __dims);
+        else
+            __doubles.resize(rows * __dims);
+    }
+
+    unsigned int PointStore::getSize() const
+    {
+        if (__dims == 0)
+            return 0;
+
+        if (__precision == SINGLE_PRECISION)
+            return __floats.size() / __dims;
+
+        return __doubles.size() / __dims;
+    }
+
+    std::size_t PointStore::memoryFootprint() const
+    {
+        return __doubles.size() * sizeof(double) + __floats.size() * sizeof(float);
+    }
+
+}
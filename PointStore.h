@@ -0,0 +1,76 @@
+// Contiguous, row-major copy of the points a KMeans run works on, in
+// either double or single precision. It is held in addition to the
+// Points, not instead of them, so KMeans only keeps one where the copy
+// earns its memory: single precision rows, or rows placed on the NUMA
+// nodes of a pinned pool.
+
+#ifndef CLUSTERING_POINTSTORE_H
+#define CLUSTERING_POINTSTORE_H
+
+#include "Point.h"
+#include <vector>
+#include <cstddef>
+#include <new>
+#include <memory>
+#include <utility>
+
+namespace Clustering {
+
+    enum Precision { DOUBLE_PRECISION, SINGLE_PRECISION };
+
+    // Leaves value-initialized elements uninitialized, so resize() does not
+    // write the new pages; whichever thread fills a row first places it
+    // on its own NUMA node
+    template <typename T>
+    struct UninitializedAllocator : std::allocator<T> {
+        template <typename U> struct rebind { typedef UninitializedAllocator<U> other; };
+
+        UninitializedAllocator() {}
+        template <typename U> UninitializedAllocator(const UninitializedAllocator<U> &) {}
+
+        template <typename U> void construct(U *p) { ::new (static_cast<void *>(p)) U; }
+        template <typename U, typename... Args> void construct(U *p, Args &&... args)
+        {
+            ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+        }
+    };
+
+    class PointStore {
+        unsigned int __dims;
+        Precision __precision;
+        std::vector<double, UninitializedAllocator<double> > __doubles;
+        std::vector<float, UninitializedAllocator<float> > __floats;
+
+    public:
+        PointStore(unsigned int dims, Precision precision = DOUBLE_PRECISION) :
+                __dims(dims), __precision(precision) {};
+
+        // Appends a copy of the point's coordinates, returns its row index
+        unsigned int append(const Point &);
+        unsigned int appendRow(const double *coords);
+        // Overwrites an existing row, converting to the store's precision
+        void setRow(unsigned int index, const double *coords);
+        void clear();
+        void reserve(unsigned int rows);
+        // Grows or shrinks to `rows` rows; new rows are left unwritten for setRow
+        void resize(unsigned int rows);
+
+        unsigned int getSize() const;
+        unsigned int getDims() const { return __dims; }
+        Precision getPrecision() const { return __precision; }
+
+        // Only the row type matching getPrecision() is populated
+        const double *doubleRow(unsigned int index) const { return &__doubles[index * __dims]; }
+        const float *floatRow(unsigned int index) const { return &__floats[index * __dims]; }
+        template <typename T> const T *row(unsigned int index) const;
+
+        // Bytes held by the coordinate buffer
+        std::size_t memoryFootprint() const;
+    };
+
+    template <> inline const double *PointStore::row<double>(unsigned int index) const { return doubleRow(index); }
+    template <> inline const float *PointStore::row<float>(unsigned int index) const { return floatRow(index); }
+
+}
+
+#endif //CLUSTERING_POINTSTORE_H
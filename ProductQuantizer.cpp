@@ -0,0 +1,140 @@
+#include "ProductQuantizer.h"
+#include <algorithm>
+#include <limits>
+#include <random>
+
+using namespace Clustering;
+
+namespace Clustering {
+
+    constexpr unsigned int ProductQuantizer::MAX_CODEWORDS;
+
+    ProductQuantizer::ProductQuantizer(const std::vector<PointPtr> &points, unsigned int dims, unsigned int subspaces,
+                                       unsigned int codewords, unsigned int seed, unsigned int iterations,
+                                       ThreadPool &pool) :
+            __dims(dims)
+    {
+        unsigned int n = points.size();
+        __subspaces = std::max(1u, std::min(subspaces, dims));
+        __codewords = std::max(1u, std::min(std::min(codewords, MAX_CODEWORDS), n));
+
+        // Equal widths, the first dims % subspaces one wider
+        for (unsigned int m = 0; m <= __subspaces; m++)
+        {
+            __offsets.push_back(m * (dims / __subspaces) + std::min(m, dims % __subspaces));
+        }
+        for (unsigned int m = 0; m < __subspaces; m++)
+        {
+            __distances.push_back(selectDistanceKernel<double>(__offsets[m + 1] - __offsets[m]));
+        }
+
+        __codebooks.assign(__codewords * dims, 0.0);
+        __codes.assign(n * __subspaces, 0);
+
+        // Subspaces are independent, and each is seeded on its own
+        pool.parallelFor(0, __subspaces, 1, [&](unsigned int, unsigned int first, unsigned int last) {
+            for (unsigned int m = first; m < last; m++)
+            {
+                train(points, m, seed + m, iterations);
+            }
+        });
+    }
+
+    void ProductQuantizer::train(const std::vector<PointPtr> &points, unsigned int m,
+                                 unsigned int seed, unsigned int iterations)
+    {
+        unsigned int n = points.size();
+        unsigned int offset = __offsets[m];
+        unsigned int width = __offsets[m + 1] - offset;
+        DistanceKernel distance = __distances[m];
+
+        if (n == 0)
+        {
+            return;
+        }
+
+        // Codewords start on distinct rows, as in KMeans::seedCentroids
+        std::mt19937 generator(seed);
+        std::vector<unsigned int> rows(n);
+        for (unsigned int j = 0; j < n; j++)
+        {
+            rows[j] = j;
+        }
+        for (unsigned int c = 0; c < __codewords; c++)
+        {
+            std::uniform_int_distribution<unsigned int> pick(c, n - 1);
+            std::swap(rows[c], rows[pick(generator)]);
+            copyCoords(&__codebooks[c * __dims + offset], points[rows[c]]->data() + offset, width);
+        }
+
+        std::vector<double> sums(__codewords * width);
+        std::vector<unsigned int> counts(__codewords);
+        for (unsigned int iteration = 0; iteration <= iterations; iteration++)
+        {
+            std::fill(sums.begin(), sums.end(), 0.0);
+            std::fill(counts.begin(), counts.end(), 0);
+
+            bool moved = false;
+            for (unsigned int j = 0; j < n; j++)
+            {
+                const double *slice = points[j]->data() + offset;
+                unsigned int best = 0;
+                double bestDistance = std::numeric_limits<double>::max();
+                for (unsigned int c = 0; c < __codewords; c++)
+                {
+                    double d = distance(slice, &__codebooks[c * __dims + offset], width);
+                    if (d < bestDistance)
+                    {
+                        bestDistance = d;
+                        best = c;
+                    }
+                }
+
+                unsigned char &code = __codes[j * __subspaces + m];
+                moved = moved || (iteration == 0) || (code != best);
+                code = best;
+                addCoords(&sums[best * width], slice, width);
+                counts[best]++;
+            }
+
+            // The last pass only encodes against the final codebook
+            if (!moved || iteration == iterations)
+            {
+                break;
+            }
+
+            for (unsigned int c = 0; c < __codewords; c++)
+            {
+                if (counts[c] > 0)
+                {
+                    divideCoords(&sums[c * width], counts[c], width);
+                    copyCoords(&__codebooks[c * __dims + offset], &sums[c * width], width);
+                }
+            }
+        }
+    }
+
+    void ProductQuantizer::table(const double *centroid, double *table) const
+    {
+        for (unsigned int m = 0; m < __subspaces; m++)
+        {
+            unsigned int offset = __offsets[m];
+            unsigned int width = __offsets[m + 1] - offset;
+            for (unsigned int c = 0; c < __codewords; c++)
+            {
+                table[m * __codewords + c] = __distances[m](centroid + offset,
+                                                             &__codebooks[c * __dims + offset], width);
+            }
+        }
+    }
+
+    void ProductQuantizer::decode(const unsigned char *code, double *coords) const
+    {
+        for (unsigned int m = 0; m < __subspaces; m++)
+        {
+            unsigned int offset = __offsets[m];
+            copyCoords(coords + offset, &__codebooks[code[m] * __dims + offset], __offsets[m + 1] - offset);
+        }
+    }
+
+}
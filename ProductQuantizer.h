@@ -0,0 +1,64 @@
+// Product quantization of a fixed set of points for approximate
+// nearest-centroid search. The coordinates are split into subspaces; each
+// subspace gets its own small codebook, trained with Lloyd on the points'
+// slices, and every point is stored as one byte per subspace. The squared
+// distance from a centroid to a point is then approximated by adding one
+// table entry per subspace (asymmetric distance: the centroid stays exact).
+
+#ifndef CLUSTERING_PRODUCTQUANTIZER_H
+#define CLUSTERING_PRODUCTQUANTIZER_H
+
+#include "Cluster.h"
+#include "FixedPoint.h"
+#include "ThreadPool.h"
+#include <vector>
+
+namespace Clustering {
+
+    class ProductQuantizer {
+        unsigned int __dims;
+        unsigned int __subspaces;
+        unsigned int __codewords;
+        std::vector<unsigned int> __offsets;     // subspace m is [__offsets[m], __offsets[m + 1])
+        std::vector<DistanceKernel> __distances; // one per subspace width
+        std::vector<double> __codebooks;         // codeword c of every subspace in row c, dims wide
+        std::vector<unsigned char> __codes;      // __subspaces per point
+
+        void train(const std::vector<PointPtr> &points, unsigned int subspace,
+                   unsigned int seed, unsigned int iterations);
+
+    public:
+        // Codes are one byte, so at most this many codewords per subspace
+        static constexpr unsigned int MAX_CODEWORDS = 256;
+
+        // Trains the codebooks on points[0..n) and encodes them. Subspaces
+        // are clamped to [1, dims] and codewords to [1, min(n, 256)].
+        ProductQuantizer(const std::vector<PointPtr> &points, unsigned int dims, unsigned int subspaces,
+                         unsigned int codewords = MAX_CODEWORDS, unsigned int seed = 0,
+                         unsigned int iterations = 10, ThreadPool &pool = *ThreadPool::shared());
+
+        unsigned int getSubspaces() const { return __subspaces; }
+        unsigned int getCodewords() const { return __codewords; }
+        unsigned int getSize() const { return __codes.size() / __subspaces; }
+        const unsigned char *code(unsigned int row) const { return &__codes[row * __subspaces]; }
+
+        // Squared distance from centroid to every codeword of every
+        // subspace, subspaces x codewords entries
+        void table(const double *centroid, double *table) const;
+        double distance(const unsigned char *code, const double *table) const
+        {
+            double sum = 0;
+            for (unsigned int m = 0; m < __subspaces; m++)
+            {
+                sum += table[m * __codewords + code[m]];
+            }
+            return sum;
+        }
+
+        // The point a code stands for, dims wide
+        void decode(const unsigned char *code, double *coords) const;
+    };
+
+}
+
+#endif //CLUSTERING_PRODUCTQUANTIZER_H
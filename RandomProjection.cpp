@@ -0,0 +1,55 @@
+#include "RandomProjection.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+using namespace Clustering;
+
+namespace Clustering {
+
+    RandomProjection::RandomProjection(unsigned int inDims, unsigned int outDims, unsigned int seed) :
+            __inDims(inDims), __outDims(outDims)
+    {
+        double s = std::max(1.0, std::sqrt(static_cast<double>(inDims)));
+        double magnitude = std::sqrt(s / std::max(1u, outDims));
+
+        std::mt19937 generator(seed);
+        std::uniform_real_distribution<double> draw(0, 1);
+
+        __starts.push_back(0);
+        for (unsigned int o = 0; o < outDims; o++)
+        {
+            for (unsigned int i = 0; i < inDims; i++)
+            {
+                double u = draw(generator);
+                if (u < 1 / s)
+                {
+                    __columns.push_back(i);
+                    __values.push_back(u < 0.5 / s ? magnitude : -magnitude);
+                }
+            }
+            __starts.push_back(__columns.size());
+        }
+    }
+
+    unsigned int RandomProjection::targetDims(unsigned int points, double epsilon)
+    {
+        // Dasgupta and Gupta: 4 ln n / (eps^2 / 2 - eps^3 / 3)
+        double bound = epsilon * epsilon / 2 - epsilon * epsilon * epsilon / 3;
+        return static_cast<unsigned int>(std::ceil(4 * std::log(std::max(2u, points)) / bound));
+    }
+
+    void RandomProjection::project(const double *in, double *out) const
+    {
+        for (unsigned int o = 0; o < __outDims; o++)
+        {
+            double sum = 0;
+            for (unsigned int e = __starts[o]; e < __starts[o + 1]; e++)
+            {
+                sum += __values[e] * in[__columns[e]];
+            }
+            out[o] = sum;
+        }
+    }
+
+}
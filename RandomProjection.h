@@ -0,0 +1,38 @@
+// Seeded sparse random projection (Johnson-Lindenstrauss). Entry (o, i) of
+// the out x in matrix is +-sqrt(s / out) with probability 1 / (2s) each and
+// 0 otherwise, s = sqrt(in) (Li, Hastie and Church), so squared distances
+// are preserved in expectation while a row only touches ~sqrt(in) inputs.
+
+#ifndef CLUSTERING_RANDOMPROJECTION_H
+#define CLUSTERING_RANDOMPROJECTION_H
+
+#include <vector>
+
+namespace Clustering {
+
+    class RandomProjection {
+        unsigned int __inDims;
+        unsigned int __outDims;
+        // Nonzeros of output o are __columns / __values [__starts[o], __starts[o + 1])
+        std::vector<unsigned int> __starts;
+        std::vector<unsigned int> __columns;
+        std::vector<double> __values;
+
+    public:
+        RandomProjection(unsigned int inDims, unsigned int outDims, unsigned int seed = 0);
+
+        // Dimensions that keep every pairwise squared distance of `points`
+        // points within a factor 1 +- epsilon with high probability
+        static unsigned int targetDims(unsigned int points, double epsilon);
+
+        unsigned int getInDims() const { return __inDims; }
+        unsigned int getOutDims() const { return __outDims; }
+        unsigned int getNonZeros() const { return __columns.size(); }
+
+        // out must hold getOutDims() values
+        void project(const double *in, double *out) const;
+    };
+
+}
+
+#endif //CLUSTERING_RANDOMPROJECTION_H
@@ -0,0 +1,38 @@
+#include "Reduction.h"
+
+using namespace Clustering;
+
+namespace {
+
+    template <typename T>
+    void reduceBuffers(std::vector<std::vector<T> > &buffers)
+    {
+        for (unsigned int stride = 1; stride < buffers.size(); stride *= 2)
+        {
+            for (unsigned int i = 0; i + stride < buffers.size(); i += 2 * stride)
+            {
+                std::vector<T> &into = buffers[i];
+                const std::vector<T> &from = buffers[i + stride];
+                for (unsigned int e = 0; e < into.size(); e++)
+                {
+                    into[e] += from[e];
+                }
+            }
+        }
+    }
+
+}
+
+namespace Clustering {
+
+    void treeReduceInto(std::vector<std::vector<double> > &buffers)
+    {
+        reduceBuffers(buffers);
+    }
+
+    void treeReduceInto(std::vector<std::vector<unsigned int> > &buffers)
+    {
+        reduceBuffers(buffers);
+    }
+
+}
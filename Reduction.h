@@ -0,0 +1,61 @@
+// Order-fixed floating-point reductions.
+// Parallel stages reduce over partitions whose bounds depend only on the
+// input size, combined in a fixed pairwise tree, so the same input gives
+// bit-identical sums for any thread count and scheduling.
+
+#ifndef CLUSTERING_REDUCTION_H
+#define CLUSTERING_REDUCTION_H
+
+#include <vector>
+#include <cmath>
+
+namespace Clustering {
+
+    // Neumaier's compensated sum: the rounding error of every addition is
+    // carried separately, so long sums of similar terms lose no precision
+    struct CompensatedSum {
+        double sum = 0;
+        double compensation = 0;
+
+        void add(double value)
+        {
+            double total = sum + value;
+            if (std::fabs(sum) >= std::fabs(value))
+                compensation += (sum - total) + value;
+            else
+                compensation += (value - total) + sum;
+            sum = total;
+        }
+
+        CompensatedSum &operator+=(const CompensatedSum &other)
+        {
+            add(other.sum);
+            compensation += other.compensation;
+            return *this;
+        }
+
+        double value() const { return sum + compensation; }
+    };
+
+    // Pairwise tree: partials[i] += partials[i + stride] for stride = 1, 2, 4...
+    template <typename T>
+    T treeReduce(std::vector<T> partials)
+    {
+        if (partials.empty())
+            return T();
+
+        for (unsigned int stride = 1; stride < partials.size(); stride *= 2)
+        {
+            for (unsigned int i = 0; i + stride < partials.size(); i += 2 * stride)
+                partials[i] += partials[i + stride];
+        }
+        return partials[0];
+    }
+
+    // Element-wise treeReduce of equally sized buffers into buffers[0]
+    void treeReduceInto(std::vector<std::vector<double> > &buffers);
+    void treeReduceInto(std::vector<std::vector<unsigned int> > &buffers);
+
+}
+
+#endif //CLUSTERING_REDUCTION_H
@@ -0,0 +1,156 @@
+#include "SparseStore.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+using namespace Clustering;
+
+namespace Clustering {
+
+    unsigned int SparseStore::appendRow(const double *coords)
+    {
+        double norm = 0;
+        for (unsigned int d = 0; d < __dims; d++)
+        {
+            if (coords[d] != 0)
+            {
+                __columns.push_back(d);
+                __values.push_back(coords[d]);
+                norm += coords[d] * coords[d];
+            }
+        }
+        __starts.push_back(__columns.size());
+        __norms.push_back(norm);
+
+        return __norms.size() - 1;
+    }
+
+    unsigned int SparseStore::appendEntries(const Entries &entries)
+    {
+        double norm = 0;
+        for (unsigned int e = 0; e < entries.size(); e++)
+        {
+            if (entries[e].second != 0)
+            {
+                __columns.push_back(entries[e].first);
+                __values.push_back(entries[e].second);
+                norm += entries[e].second * entries[e].second;
+            }
+        }
+        __starts.push_back(__columns.size());
+        __norms.push_back(norm);
+
+        return __norms.size() - 1;
+    }
+
+    void SparseStore::clear()
+    {
+        __starts.assign(1, 0);
+        __columns.clear();
+        __values.clear();
+        __norms.clear();
+    }
+
+    double SparseStore::distanceSquared(unsigned int row, const double *point, double pointNorm) const
+    {
+        double dot = 0;
+        for (std::size_t e = __starts[row]; e < __starts[row + 1]; e++)
+        {
+            dot += __values[e] * point[__columns[e]];
+        }
+
+        // Cancellation can leave a tiny negative for nearly equal points
+        return std::max(0.0, __norms[row] - 2 * dot + pointNorm);
+    }
+
+    double SparseStore::distanceSquared(unsigned int a, unsigned int b) const
+    {
+        double dot = 0;
+        std::size_t i = __starts[a], j = __starts[b];
+        while (i < __starts[a + 1] && j < __starts[b + 1])
+        {
+            if (__columns[i] < __columns[j])
+            {
+                i++;
+            }
+            else if (__columns[j] < __columns[i])
+            {
+                j++;
+            }
+            else
+            {
+                dot += __values[i++] * __values[j++];
+            }
+        }
+
+        return std::max(0.0, __norms[a] - 2 * dot + __norms[b]);
+    }
+
+    void SparseStore::addTo(unsigned int row, double *dense) const
+    {
+        for (std::size_t e = __starts[row]; e < __starts[row + 1]; e++)
+        {
+            dense[__columns[e]] += __values[e];
+        }
+    }
+
+    void SparseStore::copyTo(unsigned int row, double *dense) const
+    {
+        std::fill(dense, dense + __dims, 0.0);
+        addTo(row, dense);
+    }
+
+    std::size_t SparseStore::memoryFootprint() const
+    {
+        return __starts.capacity() * sizeof(std::size_t) + __columns.capacity() * sizeof(unsigned int) +
+               (__values.capacity() + __norms.capacity()) * sizeof(double);
+    }
+
+    bool SparseStore::parseRow(const std::string &line, unsigned int dims, Entries &entries)
+    {
+        entries.clear();
+
+        const char *cursor = line.c_str();
+
+        // LIBSVM rows start with the label
+        const char *token = cursor + std::strspn(cursor, " ,\t\r");
+        std::size_t length = std::strcspn(token, " ,\t\r");
+        if (std::find(token, token + length, ':') == token + length)
+        {
+            cursor = token + length;
+        }
+
+        while (true)
+        {
+            while (*cursor == ' ' || *cursor == ',' || *cursor == '\t' || *cursor == '\r')
+            {
+                cursor++;
+            }
+            if (*cursor == '\0')
+            {
+                break;
+            }
+
+            char *end;
+            long index = std::strtol(cursor, &end, 10);
+            if (end == cursor || *end != ':' || index < 1 || index > static_cast<long>(dims))
+            {
+                return false;
+            }
+
+            cursor = end + 1;
+            double value = std::strtod(cursor, &end);
+            if (end == cursor)
+            {
+                return false;
+            }
+            cursor = end;
+
+            entries.push_back(std::make_pair(static_cast<unsigned int>(index - 1), value));
+        }
+
+        std::sort(entries.begin(), entries.end());
+        return true;
+    }
+
+}
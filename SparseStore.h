@@ -0,0 +1,63 @@
+// Compressed sparse row copy of the points a KMeans run works on, for data
+// where most coordinates are zero. Distances to dense centroids expand as
+// |x|^2 - 2 x.c + |c|^2, so with the norms precomputed each one costs a
+// dot product over the row's nonzeros instead of a loop over every dimension.
+
+#ifndef CLUSTERING_SPARSESTORE_H
+#define CLUSTERING_SPARSESTORE_H
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstddef>
+
+namespace Clustering {
+
+    class SparseStore {
+        unsigned int __dims;
+        // Nonzeros of row j are __columns / __values [__starts[j], __starts[j + 1]),
+        // columns ascending and 0-based
+        std::vector<std::size_t> __starts;
+        std::vector<unsigned int> __columns;
+        std::vector<double> __values;
+        std::vector<double> __norms; // squared, per row
+
+    public:
+        typedef std::vector<std::pair<unsigned int, double> > Entries;
+
+        SparseStore(unsigned int dims) : __dims(dims), __starts(1, 0) {};
+
+        // Appends the nonzeros of a dense row, returns its row index
+        unsigned int appendRow(const double *coords);
+        // Appends a row parsed by parseRow, without a dense copy
+        unsigned int appendEntries(const Entries &entries);
+        void clear();
+
+        unsigned int getSize() const { return __norms.size(); }
+        unsigned int getDims() const { return __dims; }
+        std::size_t getNonZeros() const { return __columns.size(); }
+        double norm(unsigned int row) const { return __norms[row]; }
+
+        // Squared distance from a row to a dense point of squared norm pointNorm
+        double distanceSquared(unsigned int row, const double *point, double pointNorm) const;
+        // Squared distance between two rows
+        double distanceSquared(unsigned int a, unsigned int b) const;
+        // dense += row
+        void addTo(unsigned int row, double *dense) const;
+        // dense = row, all getDims() coordinates written
+        void copyTo(unsigned int row, double *dense) const;
+
+        // Bytes held by the rows
+        std::size_t memoryFootprint() const;
+
+        // Parses "index:value" pairs separated by spaces or commas, with
+        // 1-based indices as in Point::setValue. A leading token without a
+        // colon is a label, as in LIBSVM files, and is skipped. Returns
+        // false, leaving entries unspecified, if the line is malformed or an
+        // index is outside [1, dims]. Entries come back sorted by index, 0-based.
+        static bool parseRow(const std::string &line, unsigned int dims, Entries &entries);
+    };
+
+}
+
+#endif //CLUSTERING_SPARSESTORE_H
@@ -0,0 +1,299 @@
+#include "ThreadPool.h"
+#include "NumaTopology.h"
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace Clustering;
+
+namespace {
+
+    // Pool and queue of the worker running on this thread, if any
+    thread_local ThreadPool *currentPool = nullptr;
+    thread_local unsigned int currentQueue = 0;
+
+    std::mutex sharedMutex;
+    std::shared_ptr<ThreadPool> sharedPool;
+
+    // Chunks of one parallelFor still to finish. The last one notifies
+    // under the lock, so the waiter cannot return and destroy the latch
+    // before notify_all() is done with it.
+    struct Latch {
+        std::mutex mutex;
+        std::condition_variable done;
+        unsigned int remaining;
+
+        explicit Latch(unsigned int count) : remaining(count) { }
+
+        void countDown()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--remaining == 0)
+            {
+                done.notify_all();
+            }
+        }
+
+        bool finished()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return remaining == 0;
+        }
+
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this]() { return remaining == 0; });
+        }
+    };
+
+}
+
+namespace Clustering {
+
+    ThreadPool::ThreadPool(unsigned int threads, const std::vector<int> &cpus) :
+            __pending(0), __nextQueue(0), __stopping(false), __pinned(false)
+    {
+        if (threads == 0)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        for (unsigned int i = 0; i + 1 < threads; i++)
+        {
+            __queues.emplace_back(new Queue);
+        }
+
+        for (unsigned int i = 0; i + 1 < threads; i++)
+        {
+            __workers.emplace_back(&ThreadPool::workerLoop, this, i);
+
+#ifdef __linux__
+            if (!cpus.empty())
+            {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(workerCpu(cpus, i, threads - 1), &set);
+                pthread_setaffinity_np(__workers.back().native_handle(), sizeof(set), &set);
+                __pinned = true;
+            }
+#endif
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(__sleepMutex);
+            __stopping = true;
+        }
+        __wake.notify_all();
+
+        for (unsigned int i = 0; i < __workers.size(); i++)
+        {
+            __workers[i].join();
+        }
+    }
+
+    std::shared_ptr<ThreadPool> ThreadPool::shared()
+    {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        if (!sharedPool)
+        {
+            NumaTopology topology = NumaTopology::detect();
+            sharedPool = std::make_shared<ThreadPool>(0, topology.getNodes() > 1 ? topology.cpusInNodeOrder()
+                                                                                 : std::vector<int>());
+        }
+        return sharedPool;
+    }
+
+    void ThreadPool::configureShared(unsigned int threads, const std::vector<int> &cpus)
+    {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        sharedPool = std::make_shared<ThreadPool>(threads, cpus);
+    }
+
+    int ThreadPool::workerCpu(const std::vector<int> &cpus, unsigned int worker, unsigned int workers)
+    {
+        if (workers >= cpus.size())
+        {
+            return cpus[worker % cpus.size()];
+        }
+        return cpus[static_cast<unsigned long long>(worker) * cpus.size() / workers];
+    }
+
+    void ThreadPool::push(std::function<void()> task, int queue)
+    {
+        // Workers keep what they spawn local; other threads spread it out
+        unsigned int index = (currentPool == this) ? currentQueue : __nextQueue++ % __queues.size();
+        if (queue >= 0)
+        {
+            index = queue;
+        }
+
+        // Counted before it can be taken, so a worker's decrement in
+        // runOne() never runs ahead of this increment
+        {
+            std::lock_guard<std::mutex> lock(__sleepMutex);
+            __pending++;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(__queues[index]->mutex);
+            __queues[index]->tasks.push_back(std::move(task));
+        }
+        __wake.notify_one();
+    }
+
+    bool ThreadPool::runOne()
+    {
+        std::function<void()> task;
+        unsigned int own = (currentPool == this) ? currentQueue : 0;
+
+        for (unsigned int i = 0; i < __queues.size() && !task; i++)
+        {
+            unsigned int index = (own + i) % __queues.size();
+            std::lock_guard<std::mutex> lock(__queues[index]->mutex);
+            std::deque<std::function<void()> > &tasks = __queues[index]->tasks;
+
+            if (tasks.empty())
+            {
+                continue;
+            }
+
+            if (currentPool == this && index == own)
+            {
+                task = std::move(tasks.back());
+                tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+        }
+
+        if (!task)
+        {
+            return false;
+        }
+
+        __pending--;
+        task();
+        return true;
+    }
+
+    void ThreadPool::workerLoop(unsigned int index)
+    {
+        currentPool = this;
+        currentQueue = index;
+
+        while (true)
+        {
+            if (runOne())
+            {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(__sleepMutex);
+            __wake.wait(lock, [this]() { return __stopping || __pending > 0; });
+            if (__stopping)
+            {
+                return;
+            }
+        }
+    }
+
+    void ThreadPool::parallelFor(const std::vector<unsigned int> &bounds,
+                                 const std::function<void(unsigned int, unsigned int, unsigned int)> &body,
+                                 bool placed)
+    {
+        if (bounds.size() < 2)
+        {
+            return;
+        }
+
+        unsigned int chunks = bounds.size() - 1;
+        if (chunks == 1 || __workers.empty())
+        {
+            for (unsigned int c = 0; c < chunks; c++)
+            {
+                body(c, bounds[c], bounds[c + 1]);
+            }
+            return;
+        }
+
+        Latch latch(chunks);
+        for (unsigned int c = placed ? 0 : 1; c < chunks; c++)
+        {
+            int queue = placed ? static_cast<int>(static_cast<unsigned long long>(c) * __queues.size() / chunks) : -1;
+            push([&body, &bounds, &latch, c]() {
+                body(c, bounds[c], bounds[c + 1]);
+                latch.countDown();
+            }, queue);
+        }
+
+        // Unless placed, the first chunk runs here; then help until the
+        // rest is done
+        if (!placed)
+        {
+            body(0, bounds[0], bounds[1]);
+            latch.countDown();
+        }
+
+        // Our chunks were all queued above, so once nothing is left to
+        // take they are running elsewhere: sleep until they finish rather
+        // than spin, which would hold a core (a runAsync driver is not
+        // even one of the pool's threads)
+        while (!latch.finished())
+        {
+            if (!runOne())
+            {
+                latch.wait();
+            }
+        }
+    }
+
+    void ThreadPool::parallelFor(unsigned int begin, unsigned int end, unsigned int grain,
+                                 const std::function<void(unsigned int, unsigned int, unsigned int)> &body,
+                                 bool placed)
+    {
+        grain = std::max(1u, grain);
+
+        std::vector<unsigned int> bounds;
+        for (unsigned int first = begin; first < end; first += std::min(grain, end - first))
+        {
+            bounds.push_back(first);
+        }
+        bounds.push_back(end);
+
+        parallelFor(bounds, body, placed);
+    }
+
+    std::vector<unsigned int> ThreadPool::weightedBounds(const std::vector<double> &weights, unsigned int chunks)
+    {
+        double total = 0;
+        for (unsigned int i = 0; i < weights.size(); i++)
+        {
+            total += weights[i];
+        }
+
+        std::vector<unsigned int> bounds(1, 0);
+        double sum = 0;
+        for (unsigned int i = 0; i < weights.size(); i++)
+        {
+            sum += weights[i];
+            if (sum >= total * bounds.size() / chunks && bounds.size() < chunks && i + 1 < weights.size())
+            {
+                bounds.push_back(i + 1);
+            }
+        }
+        bounds.push_back(weights.size());
+
+        return bounds;
+    }
+
+}
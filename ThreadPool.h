@@ -0,0 +1,87 @@
+// Work-stealing task pool shared by every parallel stage of the library.
+// Each worker owns a deque: it pops its own tasks from the back and, when
+// idle, steals from the front of the others. A thread waiting on a
+// parallelFor runs queued tasks itself, so parallel stages can nest, and
+// sleeps once there is nothing left to take.
+
+#ifndef CLUSTERING_THREADPOOL_H
+#define CLUSTERING_THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+namespace Clustering {
+
+    class ThreadPool {
+        struct Queue {
+            std::mutex mutex;
+            std::deque<std::function<void()> > tasks;
+        };
+
+        std::vector<std::unique_ptr<Queue> > __queues; // one per worker
+        std::vector<std::thread> __workers;
+        std::mutex __sleepMutex;
+        std::condition_variable __wake;
+        std::atomic<unsigned int> __pending; // queued and not yet taken, counted before queueing
+        std::atomic<unsigned int> __nextQueue; // round robin for outside threads
+        bool __stopping;
+        bool __pinned;
+
+        void push(std::function<void()> task, int queue = -1);
+        bool runOne(); // runs one queued task, false if there was none
+        void workerLoop(unsigned int index);
+
+    public:
+        // threads counts the caller of parallelFor, so threads - 1 workers are
+        // started; 0 means one per core. Workers are pinned to cpus, see
+        // workerCpu, where the platform supports it.
+        ThreadPool(unsigned int threads = 0, const std::vector<int> &cpus = std::vector<int>());
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        unsigned int getThreads() const { return __workers.size() + 1; }
+        // Whether the workers were pinned, so rows they first touch stay local
+        bool isPinned() const { return __pinned; }
+
+        // CPU of worker `worker` of `workers`. Fewer workers than CPUs are
+        // spread evenly over the list, so with NumaTopology::cpusInNodeOrder
+        // every node gets workers in proportion to its CPUs; more wrap around.
+        static int workerCpu(const std::vector<int> &cpus, unsigned int worker, unsigned int workers);
+
+        // The pool used by default, pinned node by node on a host with more
+        // than one NUMA node. configureShared replaces it; holders of the
+        // previous pool keep it running until they release it.
+        static std::shared_ptr<ThreadPool> shared();
+        static void configureShared(unsigned int threads, const std::vector<int> &cpus = std::vector<int>());
+
+        // Calls body(chunk, first, last) for consecutive ranges [first, last)
+        // split at bounds; returns when every chunk has run. A placed loop
+        // queues the chunks to the workers in contiguous blocks, chunk c of n
+        // on worker c * workers / n, so two placed loops over the same bounds
+        // mostly run each chunk on the same (pinned) worker. Stealing still
+        // balances the load, so this is a preference, not a guarantee.
+        void parallelFor(const std::vector<unsigned int> &bounds,
+                         const std::function<void(unsigned int, unsigned int, unsigned int)> &body,
+                         bool placed = false);
+
+        // Splits [begin, end) into chunks of grain elements
+        void parallelFor(unsigned int begin, unsigned int end, unsigned int grain,
+                         const std::function<void(unsigned int, unsigned int, unsigned int)> &body,
+                         bool placed = false);
+
+        // Chunk bounds over weights.size() elements with roughly equal total
+        // weight per chunk, for loops whose iterations differ in cost
+        static std::vector<unsigned int> weightedBounds(const std::vector<double> &weights, unsigned int chunks);
+    };
+
+}
+
+#endif //CLUSTERING_THREADPOOL_H
@@ -36,9 +36,13 @@ int main() {
     test_point_assignment(ec, NumIters);
     test_point_equality(ec, NumIters);
     test_point_comparison(ec, NumIters);
+    test_point_sort(ec, NumIters);
     test_point_CAO(ec, NumIters);
     test_point_SAO(ec, NumIters);
+    test_point_move(ec, NumIters);
+    test_point_inline(ec, NumIters);
     test_point_distance(ec, NumIters);
+    test_point_fixeddims(ec, NumIters);
     test_point_IO(ec, NumIters);
 
     // cluster tests
@@ -46,10 +50,13 @@ int main() {
     test_cluster_equality(ec, NumIters);
     test_cluster_addremove(ec, NumIters);
     test_cluster_move(ec, NumIters);
+    test_cluster_movebatch(ec, NumIters);
     test_cluster_copying(ec, NumIters);
+    test_cluster_snapshot(ec, NumIters);
     test_cluster_assignment(ec, NumIters);
     test_cluster_CAO(ec, NumIters);
     test_cluster_SAO(ec, NumIters);
+    test_cluster_setops(ec, NumIters);
     test_cluster_centroid(ec, NumIters);
     test_cluster_id(ec, NumIters);
     test_cluster_initselection(ec, NumIters);
@@ -60,9 +67,28 @@ int main() {
     test_kmeans_smoketest(ec);
     test_kmeans_IO(ec, NumIters);
     test_kmeans_score(ec, NumIters);
+    test_kmeans_membership(ec, NumIters);
+    test_kmeans_precision(ec, NumIters);
+    test_kmeans_labels(ec, NumIters);
+    test_kmeans_convergence(ec, NumIters);
+    test_kmeans_deadline(ec, NumIters);
+    test_kmeans_async(ec, NumIters);
+    test_kmeans_reproducible(ec, NumIters);
+    test_kmeans_restarts(ec, NumIters);
+    test_kmeans_sweep(ec, NumIters);
+    test_kmeans_kdtree(ec, NumIters);
+    test_kmeans_indexed(ec, NumIters);
+    test_kmeans_quantized(ec, NumIters);
+    test_kmeans_projection(ec, NumIters);
+    test_kmeans_sparse(ec, NumIters);
+    test_kmeans_metric(ec, NumIters);
 //    test_kmeans_toofewpoints(ec, NumIters);
     test_kmeans_largepoints(ec, NumIters);
     test_kmeans_toomanyclusters(ec, NumIters);
 
+    // thread pool tests
+    test_threadpool(ec, NumIters);
+    test_threadpool_numa(ec, NumIters);
+
     return 0;
 }